@@ -0,0 +1,191 @@
+#include <string.h>
+
+#include "autopilot.h"
+#include "dungeon.h"
+#include "pc.h"
+#include "move.h"
+#include "path.h"
+#include "object.h"
+#include "utils.h"
+
+/* move_pc() takes keypad directions: 7 8 9 above, 4 5 6 level, 1 2 3 *
+ * below.                                                              */
+static uint32_t keypad_dir(int16_t dx, int16_t dy)
+{
+  return (dy < 0 ? 7 : dy ? 1 : 4) + dx + 1;
+}
+
+static void autopilot_wander(dungeon *d)
+{
+  /* Moving in place (5) always works. */
+  while (move_pc(d, rand_range(d->rng + rng_pc, 1, 9)))
+    ;
+}
+
+/* Puts on anything in the pack that has a free slot to go in, so that *
+ * the equipment code gets a workout along with everything else.       */
+static void autopilot_equip(dungeon *d)
+{
+  uint32_t i;
+  int32_t slot;
+
+  for (i = 0; i < INVENTORY_SIZE; i++) {
+    if (d->PC->in[i] && d->PC->in[i]->can_be_equipped() &&
+        (slot = d->PC->in[i]->equipment_slot_index()) >= 0 &&
+        !d->PC->eq[slot]) {
+      d->PC->equip_from_slot(i);
+    }
+  }
+}
+
+/* Takes one step along a shortest walk to goal, found by following the *
+ * PC distance map back down from there.  Wanders if goal is out of     *
+ * reach.                                                               */
+static void autopilot_step_toward(dungeon *d, pair_t goal)
+{
+  pair_t at;
+  uint32_t i;
+
+  path_ensure(d, path_walk);
+  if (d->pc_distance.at(goal[dim_x], goal[dim_y]) ==
+      d->pc_distance.infinity()                       ||
+      !d->pc_distance.at(goal[dim_x], goal[dim_y])) {
+    autopilot_wander(d);
+    return;
+  }
+
+  at[dim_x] = goal[dim_x];
+  at[dim_y] = goal[dim_y];
+  while (d->pc_distance.at(at[dim_x], at[dim_y]) > 1) {
+    for (i = 0;
+         i < PATH_STAY &&
+           (d->pc_distance.at(at[dim_x] + path_step[i][dim_x],
+                              at[dim_y] + path_step[i][dim_y]) !=
+            d->pc_distance.at(at[dim_x], at[dim_y]) - 1);
+         i++)
+      ;
+    at[dim_x] += path_step[i][dim_x];
+    at[dim_y] += path_step[i][dim_y];
+  }
+
+  if (move_pc(d, keypad_dir(at[dim_x] - d->PC->position[dim_x],
+                            at[dim_y] - d->PC->position[dim_y]))) {
+    autopilot_wander(d);
+  }
+}
+
+/* Finds the reachable cell nearest the PC that satisfies want(), by the *
+ * walking distance map.  Returns 0 if there isn't one.                  */
+static uint32_t autopilot_nearest(dungeon *d,
+                                  uint32_t (*want)(dungeon *d, pair_t p),
+                                  pair_t found)
+{
+  pair_t p;
+  uint32_t best;
+
+  path_ensure(d, path_walk);
+  best = d->pc_distance.infinity();
+  for (p[dim_y] = 1; p[dim_y] < dungeon_y(d) - 1; p[dim_y]++) {
+    for (p[dim_x] = 1; p[dim_x] < dungeon_x(d) - 1; p[dim_x]++) {
+      if (d->pc_distance.at(p[dim_x], p[dim_y]) < best && want(d, p)) {
+        best = d->pc_distance.at(p[dim_x], p[dim_y]);
+        found[dim_x] = p[dim_x];
+        found[dim_y] = p[dim_y];
+      }
+    }
+  }
+
+  return best != d->pc_distance.infinity();
+}
+
+static uint32_t is_monster(dungeon *d, pair_t p)
+{
+  return charpair(p) && charpair(p) != d->PC;
+}
+
+static uint32_t is_unexplored(dungeon *d, pair_t p)
+{
+  return pc_learned_terrain(d->PC, p[dim_y], p[dim_x]) == ter_unknown;
+}
+
+static uint32_t is_stairs_down(dungeon *d, pair_t p)
+{
+  return mappair(p) == ter_stairs_down;
+}
+
+static void autopilot_random_turn(dungeon *d)
+{
+  autopilot_wander(d);
+}
+
+static void autopilot_descend_turn(dungeon *d)
+{
+  pair_t stairs;
+
+  if (mappair(d->PC->position) == ter_stairs_down) {
+    move_pc(d, '>');
+  } else if (autopilot_nearest(d, is_stairs_down, stairs)) {
+    autopilot_step_toward(d, stairs);
+  } else {
+    autopilot_wander(d);
+  }
+}
+
+/* Goes and looks at whatever it hasn't seen yet; once there's nothing *
+ * left, it moves on to the next level.                                */
+static void autopilot_explore_turn(dungeon *d)
+{
+  pair_t goal;
+
+  autopilot_equip(d);
+  if (autopilot_nearest(d, is_unexplored, goal)) {
+    autopilot_step_toward(d, goal);
+  } else {
+    autopilot_descend_turn(d);
+  }
+}
+
+/* Walks into the nearest monster until one of them is dead. */
+static void autopilot_hunt_turn(dungeon *d)
+{
+  pair_t goal;
+
+  autopilot_equip(d);
+  if (autopilot_nearest(d, is_monster, goal)) {
+    autopilot_step_toward(d, goal);
+  } else {
+    autopilot_wander(d);
+  }
+}
+
+const pc_controller_t autopilot_random = {
+  "random", autopilot_random_turn
+};
+const pc_controller_t autopilot_explore = {
+  "explore", autopilot_explore_turn
+};
+const pc_controller_t autopilot_hunt = {
+  "hunt", autopilot_hunt_turn
+};
+const pc_controller_t autopilot_descend = {
+  "descend", autopilot_descend_turn
+};
+
+const pc_controller_t *autopilot_find(const char *name)
+{
+  static const pc_controller_t *all[] = {
+    &autopilot_random,
+    &autopilot_explore,
+    &autopilot_hunt,
+    &autopilot_descend
+  };
+  uint32_t i;
+
+  for (i = 0; i < sizeof (all) / sizeof (all[0]); i++) {
+    if (!strcmp(name, all[i]->name)) {
+      return all[i];
+    }
+  }
+
+  return NULL;
+}
@@ -0,0 +1,23 @@
+#ifndef AUTOPILOT_H
+# define AUTOPILOT_H
+
+# include <stdint.h>
+
+class dungeon;
+
+/* Something other than the keyboard that can take the PC's turns, for *
+ * unattended runs.  take_turn() is called in place of reading input,   *
+ * and has to do something that ends the turn, just as a keypress does. */
+typedef struct pc_controller {
+  const char *name;
+  void (*take_turn)(dungeon *d);
+} pc_controller_t;
+
+extern const pc_controller_t autopilot_random;
+extern const pc_controller_t autopilot_explore;
+extern const pc_controller_t autopilot_hunt;
+extern const pc_controller_t autopilot_descend;
+
+const pc_controller_t *autopilot_find(const char *name);
+
+#endif
@@ -38,7 +38,10 @@ class character {
    * characters have been created by the game.                              */
   uint32_t sequence_number;
   uint32_t kills[num_kill_types];
-  inline uint32_t get_color() { return color[rand_range(0, color.size() - 1)]; }
+  inline uint32_t get_color(rng_t *r)
+  {
+    return color[rand_range(r, 0, color.size() - 1)];
+  }
   inline char get_symbol() { return symbol; }
 };
 
@@ -7,6 +7,7 @@
 
 # include "dice.h"
 # include "npc.h"
+# include "utils.h"
 
 class dungeon;
 
@@ -54,9 +55,9 @@ class monster_description {
     return (((abilities & NPC_UNIQ) && !num_alive && !num_killed) ||
             !(abilities & NPC_UNIQ));
   }
-  inline bool pass_rarity_roll()
+  inline bool pass_rarity_roll(rng_t *r)
   {
-    return rarity > (unsigned) (rand() % 100);
+    return rarity > rng_below(r, 100);
   }
 
 public:
@@ -76,6 +77,8 @@ public:
            const uint32_t rarity);
   std::ostream &print(std::ostream &o);
   char get_symbol() { return symbol; }
+  inline const std::string &get_name() const { return name; }
+  inline uint32_t get_num_killed() const { return num_killed; }
   inline void birth()
   {
     num_alive++;
@@ -116,9 +119,9 @@ class object_description {
   {
     return !artifact || (artifact && !num_generated && !num_found);
   }
-  inline bool pass_rarity_roll()
+  inline bool pass_rarity_roll(rng_t *r)
   {
-    return rarity > (unsigned) (rand() % 100);
+    return rarity > rng_below(r, 100);
   }
   void set(const std::string &name,
            const std::string &description,
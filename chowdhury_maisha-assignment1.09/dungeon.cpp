@@ -7,8 +7,10 @@
 #include <sys/types.h>
 #include <climits>
 #include <sys/time.h>
+#include <ctime>
 #include <cassert>
 #include <cerrno>
+#include <pthread.h>
 
 #include "heap.h"
 #include "dungeon.h"
@@ -18,16 +20,63 @@
 #include "npc.h"
 #include "io.h"
 #include "object.h"
+#include "path.h"
+#include "roomgraph.h"
 
 #define DUMP_HARDNESS_IMAGES 0
 
+#define CORRIDOR_UNQUEUED ((cell_index_t) -1)
+#define CORRIDOR_MARGIN   DUNGEON_Y
+
+/* Classic levels' coordinates fit in a byte, which keeps each of the *
+ * router's cells to 16 bytes rather than 20.                          */
+#if DUNGEON_GRID_DYNAMIC
+typedef int16_t corridor_coord_t;
+#else
+typedef uint8_t corridor_coord_t;
+#endif
+
 typedef struct corridor_path {
-  heap_node_t *hn;
-  uint8_t pos[2];
-  uint8_t from[2];
+  cell_index_t slot;
+  corridor_coord_t pos[num_dims];
+  corridor_coord_t from[num_dims];
   int32_t cost;
+  uint32_t search;
 } corridor_path_t;
 
+/* Scratch space for routing corridors, shared by every corridor on a   *
+ * level.  The queue is a binary heap of cell indices, and each queued  *
+ * cell knows its slot in it, so a cheaper way to a cell just moves it  *
+ * up.  A cell belongs to the current search only if its search number  *
+ * says so; anything else is stale and treated as unreached, so nothing *
+ * has to be cleared between corridors.                                 *
+ *                                                                      *
+ * Both are indexed by cell index.  Classic levels keep them in plain   *
+ * arrays, not grids: GCC makes a sift of the heap over array members   *
+ * a good 10% faster, and that's most of generating a level.  Other     *
+ * levels allocate them.                                                */
+typedef struct corridor_router {
+#if DUNGEON_GRID_DYNAMIC
+  corridor_path_t *path;
+  cell_index_t *queue;
+#else
+  corridor_path_t path[DUNGEON_Y * DUNGEON_X];
+  cell_index_t queue[DUNGEON_Y * DUNGEON_X];
+#endif
+  uint32_t size;
+  uint32_t search;
+} corridor_router_t;
+
+/* How many classic levels' worth of cells this level has. */
+static uint32_t level_scale(dungeon *d)
+{
+  uint32_t scale;
+
+  scale = dungeon_x(d) * dungeon_y(d) / (DUNGEON_X * DUNGEON_Y);
+
+  return scale ? scale : 1;
+}
+
 static uint32_t adjacent_to_room(dungeon *d, int16_t y, int16_t x)
 {
   return (mapxy(x - 1, y) == ter_floor_room ||
@@ -41,205 +90,203 @@ static uint32_t is_open_space(dungeon *d, int16_t y, int16_t x)
   return !hardnessxy(x, y);
 }
 
-static int32_t corridor_path_cmp(const void *key, const void *with) {
-  return ((corridor_path_t *) key)->cost - ((corridor_path_t *) with)->cost;
+#define hardnesspair_inv(p) (is_open_space(d, p[dim_y], p[dim_x]) ? 127 :     \
+                             (adjacent_to_room(d, p[dim_y], p[dim_x]) ? 191 : \
+                              (255 - hardnesspair(p))))
+
+static inline int32_t corridor_path_cmp(const corridor_path_t *key,
+                                        const corridor_path_t *with)
+{
+  return key->cost - with->cost;
 }
 
-static void dijkstra_corridor(dungeon *d, pair_t from, pair_t to)
+static inline void corridor_queue_place(corridor_router_t *r, uint32_t slot,
+                                        uint32_t i)
 {
-  static corridor_path_t path[DUNGEON_Y][DUNGEON_X], *p;
-  static uint32_t initialized = 0;
-  heap_t h;
-  int32_t x, y;
+  r->queue[slot] = i;
+  r->path[i].slot = slot;
+}
 
-  if (!initialized) {
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
-        path[y][x].pos[dim_y] = y;
-        path[y][x].pos[dim_x] = x;
-      }
-    }
-    initialized = 1;
-  }
-  
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      path[y][x].cost = INT_MAX;
+static void corridor_queue_up(corridor_router_t *r, uint32_t slot)
+{
+  uint32_t i, parent;
+
+  for (i = r->queue[slot]; slot; slot = parent) {
+    parent = (slot - 1) / 2;
+    if (corridor_path_cmp(r->path + i, r->path + r->queue[parent]) >= 0) {
+      break;
     }
+    corridor_queue_place(r, slot, r->queue[parent]);
   }
+  corridor_queue_place(r, slot, i);
+}
 
-  path[from[dim_y]][from[dim_x]].cost = 0;
-
-  heap_init(&h, corridor_path_cmp, NULL);
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      if (mapxy(x, y) != ter_wall_immutable) {
-        path[y][x].hn = heap_insert(&h, &path[y][x]);
-      } else {
-        path[y][x].hn = NULL;
+static uint32_t corridor_queue_pop(corridor_router_t *r)
+{
+  uint32_t top, i, slot, child;
+
+  top = r->queue[0];
+  r->path[top].slot = CORRIDOR_UNQUEUED;
+  if (--r->size) {
+    i = r->queue[r->size];
+    for (slot = 0; (child = 2 * slot + 1) < r->size; slot = child) {
+      if (child + 1 < r->size &&
+          corridor_path_cmp(r->path + r->queue[child + 1],
+                            r->path + r->queue[child]) < 0) {
+        child++;
+      }
+      if (corridor_path_cmp(r->path + r->queue[child], r->path + i) >= 0) {
+        break;
       }
+      corridor_queue_place(r, slot, r->queue[child]);
     }
+    corridor_queue_place(r, slot, i);
   }
 
-  while ((p = (corridor_path_t *) heap_remove_min(&h))) {
-    p->hn = NULL;
-
-    if ((p->pos[dim_y] == to[dim_y]) && p->pos[dim_x] == to[dim_x]) {
-      for (x = to[dim_x], y = to[dim_y];
-           (x != from[dim_x]) || (y != from[dim_y]);
-           p = &path[y][x], x = p->from[dim_x], y = p->from[dim_y]) {
-        if (mapxy(x, y) != ter_floor_room) {
-          mapxy(x, y) = ter_floor_hall;
-          hardnessxy(x, y) = 0;
-        }
-      }
-      heap_delete(&h);
-      return;
-    }
+  return top;
+}
 
-    if ((path[p->pos[dim_y] - 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] - 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] - 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] - 1].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] + 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] + 1].hn);
-    }
-    if ((path[p->pos[dim_y] + 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair(p->pos))) {
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair(p->pos);
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] + 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
+static void corridor_queue_push(corridor_router_t *r, uint32_t i)
+{
+  if (r->path[i].slot == CORRIDOR_UNQUEUED) {
+    r->queue[r->size] = i;
+    r->path[i].slot = r->size++;
   }
+  corridor_queue_up(r, r->path[i].slot);
 }
 
-/* This is a cut-and-paste of the above.  The code is modified to  *
- * calculate paths based on inverse hardnesses so that we get a    *
- * high probability of creating at least one cycle in the dungeon. */
-static void dijkstra_corridor_inv(dungeon *d, pair_t from, pair_t to)
+/* Dijkstra's algorithm, starting from the source alone and queueing   *
+ * cells only once they're reached.  The cost of a step is charged on   *
+ * leaving a cell.  There's no heuristic toward the target: open floor  *
+ * is free to cross, so the only cost left to go that never             *
+ * overestimates is zero, and anything more lets the search settle for  *
+ * a costlier route, carving new rock between rooms already joined.     *
+ *                                                                      *
+ * Open floor being free, a search floods every corridor it touches     *
+ * before it gets anywhere, and on a level of thousands of rooms, those *
+ * touch everything; so there, a search stays within CORRIDOR_MARGIN of *
+ * the box around its ends.  There's rock all the way across any box,   *
+ * so it still always gets there.                                       */
+static void corridor_router_init(dungeon *d, corridor_router_t *r)
 {
-  static corridor_path_t path[DUNGEON_Y][DUNGEON_X], *p;
-  static uint32_t initialized = 0;
-  heap_t h;
   int32_t x, y;
-
-  if (!initialized) {
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
-        path[y][x].pos[dim_y] = y;
-        path[y][x].pos[dim_x] = x;
-      }
-    }
-    initialized = 1;
+  corridor_path_t *p;
+
+#if DUNGEON_GRID_DYNAMIC
+  if (!(r->path = (corridor_path_t *) malloc(dungeon_cells(d) *
+                                             sizeof (*r->path))) ||
+      !(r->queue = (cell_index_t *) malloc(dungeon_cells(d) *
+                                           sizeof (*r->queue)))) {
+    perror("malloc");
+    exit(-1);
   }
-  
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      path[y][x].cost = INT_MAX;
+#endif
+  for (y = 0; y < dungeon_y(d); y++) {
+    for (x = 0; x < dungeon_x(d); x++) {
+      p = r->path + cell_index(d, x, y);
+      p->pos[dim_y] = y;
+      p->pos[dim_x] = x;
+      p->search = 0;
     }
   }
+  r->size = 0;
+  r->search = 0;
+}
 
-  path[from[dim_y]][from[dim_x]].cost = 0;
+static void corridor_router_delete(corridor_router_t *r)
+{
+#if DUNGEON_GRID_DYNAMIC
+  free(r->path);
+  free(r->queue);
+#endif
+}
 
-  heap_init(&h, corridor_path_cmp, NULL);
+/* Returns 0, leaving lo and hi alone, if the search has the run of *
+ * the level.                                                        */
+static uint32_t corridor_box(dungeon *d, pair_t from, pair_t to,
+                             pair_t lo, pair_t hi)
+{
+  uint32_t i;
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      if (mapxy(x, y) != ter_wall_immutable) {
-        path[y][x].hn = heap_insert(&h, &path[y][x]);
-      } else {
-        path[y][x].hn = NULL;
-      }
+  if (level_scale(d) == 1) {
+    return 0;
+  }
+  lo[dim_x] = lo[dim_y] = 0;
+  hi[dim_x] = dungeon_x(d) - 1;
+  hi[dim_y] = dungeon_y(d) - 1;
+  for (i = 0; i < num_dims; i++) {
+    if ((from[i] < to[i] ? from[i] : to[i]) - CORRIDOR_MARGIN > lo[i]) {
+      lo[i] = (from[i] < to[i] ? from[i] : to[i]) - CORRIDOR_MARGIN;
+    }
+    if ((from[i] > to[i] ? from[i] : to[i]) + CORRIDOR_MARGIN < hi[i]) {
+      hi[i] = (from[i] > to[i] ? from[i] : to[i]) + CORRIDOR_MARGIN;
     }
   }
 
-  while ((p = (corridor_path_t *) heap_remove_min(&h))) {
-    p->hn = NULL;
+  return 1;
+}
+
+static void corridor_route(dungeon *d, corridor_router_t *r,
+                           pair_t from, pair_t to, uint32_t inverse)
+{
+  const int32_t neighbor[4] = {
+    -dungeon_stride(d), -1, 1, dungeon_stride(d)
+  };
+  corridor_path_t *p, *n;
+  int32_t x, y, cost;
+  uint32_t i, j, boxed;
+  pair_t lo, hi;
+
+  boxed = corridor_box(d, from, to, lo, hi);
+
+  r->search++;
+  r->size = 0;
+  i = cell_index(d, from[dim_x], from[dim_y]);
+  p = r->path + i;
+  p->search = r->search;
+  p->slot = CORRIDOR_UNQUEUED;
+  p->cost = 0;
+  corridor_queue_push(r, i);
+
+  while (r->size) {
+    p = r->path + (i = corridor_queue_pop(r));
+    d->gen_stats.corridor_cells++;
 
     if ((p->pos[dim_y] == to[dim_y]) && p->pos[dim_x] == to[dim_x]) {
       for (x = to[dim_x], y = to[dim_y];
            (x != from[dim_x]) || (y != from[dim_y]);
-           p = &path[y][x], x = p->from[dim_x], y = p->from[dim_y]) {
+           p = r->path + cell_index(d, x, y),
+             x = p->from[dim_x], y = p->from[dim_y]) {
         if (mapxy(x, y) != ter_floor_room) {
           mapxy(x, y) = ter_floor_hall;
           hardnessxy(x, y) = 0;
         }
       }
-      heap_delete(&h);
       return;
     }
 
-#define hardnesspair_inv(p) (is_open_space(d, p[dim_y], p[dim_x]) ? 127 :     \
-                             (adjacent_to_room(d, p[dim_y], p[dim_x]) ? 191 : \
-                              (255 - hardnesspair(p))))
-
-    if ((path[p->pos[dim_y] - 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] - 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] - 1]
-                                           [p->pos[dim_x]    ].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] - 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] - 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] - 1].hn);
-    }
-    if ((path[p->pos[dim_y]    ][p->pos[dim_x] + 1].hn) &&
-        (path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y]    ][p->pos[dim_x] + 1].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y]    ]
-                                           [p->pos[dim_x] + 1].hn);
-    }
-    if ((path[p->pos[dim_y] + 1][p->pos[dim_x]    ].hn) &&
-        (path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost >
-         p->cost + hardnesspair_inv(p->pos))) {
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].cost =
-        p->cost + hardnesspair_inv(p->pos);
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_y] = p->pos[dim_y];
-      path[p->pos[dim_y] + 1][p->pos[dim_x]    ].from[dim_x] = p->pos[dim_x];
-      heap_decrease_key_no_replace(&h, path[p->pos[dim_y] + 1]
-                                           [p->pos[dim_x]    ].hn);
+    cost = p->cost + (inverse ? hardnesspair_inv(p->pos) :
+                                hardnesspair(p->pos));
+    for (j = 0; j < 4; j++) {
+      n = r->path + i + neighbor[j];
+      y = n->pos[dim_y];
+      x = n->pos[dim_x];
+      if (mapxy(x, y) == ter_wall_immutable ||
+          (boxed && (x < lo[dim_x] || x > hi[dim_x] ||
+                     y < lo[dim_y] || y > hi[dim_y]))) {
+        continue;
+      }
+      if (n->search != r->search) {
+        n->search = r->search;
+        n->slot = CORRIDOR_UNQUEUED;
+        n->cost = INT_MAX;
+      }
+      if (n->cost > cost) {
+        n->cost = cost;
+        n->from[dim_y] = p->pos[dim_y];
+        n->from[dim_x] = p->pos[dim_x];
+        corridor_queue_push(r, i + neighbor[j]);
+      }
     }
   }
 }
@@ -247,26 +294,27 @@ static void dijkstra_corridor_inv(dungeon *d, pair_t from, pair_t to)
 /* Chooses a random point inside each room and connects them with a *
  * corridor.  Random internal points prevent corridors from exiting *
  * rooms in predictable locations.                                  */
-static int connect_two_rooms(dungeon *d, room_t *r1, room_t *r2)
+static int connect_two_rooms(dungeon *d, corridor_router_t *r,
+                             room_t *r1, room_t *r2)
 {
   pair_t e1, e2;
 
-  e1[dim_y] = rand_range(r1->position[dim_y],
+  e1[dim_y] = rand_range(d->rng + rng_level, r1->position[dim_y],
                          r1->position[dim_y] + r1->size[dim_y] - 1);
-  e1[dim_x] = rand_range(r1->position[dim_x],
+  e1[dim_x] = rand_range(d->rng + rng_level, r1->position[dim_x],
                          r1->position[dim_x] + r1->size[dim_x] - 1);
-  e2[dim_y] = rand_range(r2->position[dim_y],
+  e2[dim_y] = rand_range(d->rng + rng_level, r2->position[dim_y],
                          r2->position[dim_y] + r2->size[dim_y] - 1);
-  e2[dim_x] = rand_range(r2->position[dim_x],
+  e2[dim_x] = rand_range(d->rng + rng_level, r2->position[dim_x],
                          r2->position[dim_x] + r2->size[dim_x] - 1);
 
   /*  return connect_two_points_recursive(d, e1, e2);*/
-  dijkstra_corridor(d, e1, e2);
+  corridor_route(d, r, e1, e2, 0);
 
   return 0;
 }
 
-static int create_cycle(dungeon *d)
+static int create_cycle(dungeon *d, corridor_router_t *r)
 {
   /* Find the (approximately) farthest two rooms, then connect *
    * them by the shortest path using inverted hardnesses.      */
@@ -290,204 +338,229 @@ static int create_cycle(dungeon *d)
 
   /* Can't simply call connect_two_rooms() because it doesn't *
    * use inverse hardnesses, so duplicate it here.            */
-  e1[dim_y] = rand_range(d->rooms[p].position[dim_y],
+  e1[dim_y] = rand_range(d->rng + rng_level, d->rooms[p].position[dim_y],
                          (d->rooms[p].position[dim_y] +
                           d->rooms[p].size[dim_y] - 1));
-  e1[dim_x] = rand_range(d->rooms[p].position[dim_x],
+  e1[dim_x] = rand_range(d->rng + rng_level, d->rooms[p].position[dim_x],
                          (d->rooms[p].position[dim_x] +
                           d->rooms[p].size[dim_x] - 1));
-  e2[dim_y] = rand_range(d->rooms[q].position[dim_y],
+  e2[dim_y] = rand_range(d->rng + rng_level, d->rooms[q].position[dim_y],
                          (d->rooms[q].position[dim_y] +
                           d->rooms[q].size[dim_y] - 1));
-  e2[dim_x] = rand_range(d->rooms[q].position[dim_x],
+  e2[dim_x] = rand_range(d->rng + rng_level, d->rooms[q].position[dim_x],
                          (d->rooms[q].position[dim_x] +
                           d->rooms[q].size[dim_x] - 1));
 
-  dijkstra_corridor_inv(d, e1, e2);
+  corridor_route(d, r, e1, e2, 1);
 
   return 0;
 }
 
+/* Rooms in bands DUNGEON_Y rows tall, top to bottom, each band's rooms *
+ * left to right and right to left by turns.                          */
+static int room_band_cmp(const void *v1, const void *v2)
+{
+  const room_t *r1 = (const room_t *) v1;
+  const room_t *r2 = (const room_t *) v2;
+  int32_t b1, b2;
+
+  b1 = r1->position[dim_y] / DUNGEON_Y;
+  b2 = r2->position[dim_y] / DUNGEON_Y;
+  if (b1 != b2) {
+    return b1 - b2;
+  }
+
+  return (b1 & 1 ? r2->position[dim_x] - r1->position[dim_x] :
+                   r1->position[dim_x] - r2->position[dim_x]);
+}
+
+/* Each room is joined to the one before it.  On a classic level, that's *
+ * the order they were made in, wherever they landed; on anything bigger *
+ * that would send thousands of corridors clear across the level, so the *
+ * rooms are put in an order that keeps neighbors near each other first. */
 static int connect_rooms(dungeon *d)
 {
+  /* Not static, so that dungeons can be generated on more than one *
+   * thread at once.                                                 */
+  corridor_router_t r;
   uint32_t i;
 
+  if (level_scale(d) > 1) {
+    qsort(d->rooms, d->num_rooms, sizeof (*d->rooms), room_band_cmp);
+  }
+
+  corridor_router_init(d, &r);
+
   for (i = 1; i < d->num_rooms; i++) {
-    connect_two_rooms(d, d->rooms + i - 1, d->rooms + i);
+    connect_two_rooms(d, &r, d->rooms + i - 1, d->rooms + i);
   }
 
-  create_cycle(d);
+  create_cycle(d, &r);
+
+  corridor_router_delete(&r);
 
   return 0;
 }
 
-int gaussian[5][5] = {
-  {  1,  4,  7,  4,  1 },
-  {  4, 16, 26, 16,  4 },
-  {  7, 26, 41, 26,  7 },
-  {  4, 16, 26, 16,  4 },
-  {  1,  4,  7,  4,  1 }
-};
+/* The smoothing kernel is the 5x5 gaussian
+ *
+ *    1  4  7  4  1
+ *    4 16 26 16  4
+ *    7 26 41 26  7
+ *    4 16 26 16  4
+ *    1  4  7  4  1
+ *
+ * which is almost, but not quite, the outer product of 1 4 7 4 1 with
+ * itself: that product has 28s where this has 26s, and 49 where this
+ * has 41.  So we blur with 1 4 7 4 1 across and then down, which is 10
+ * multiplies per cell instead of 25, and take off twice the 3-cell sum
+ * across the middle row, twice the 3-cell sum down the middle column,
+ * and 4 times the center.  All integer, so the result is exact.
+ */
+static const int32_t gaussian[5] = { 1, 4, 7, 4, 1 };
+
+/* Width of the border around the diffusion grid, which is full of     *
+ * nonzero values so that the neighbor checks don't need bounds tests, *
+ * and around the blur grid, which is full of zeros so that taps past  *
+ * the edge contribute nothing.                                        */
+#define DIFFUSE_BORDER 1
+#define BLUR_BORDER    2
+#define DIFFUSE_X      (DUNGEON_X + 2 * DIFFUSE_BORDER)
+#define DIFFUSE_Y      (DUNGEON_Y + 2 * DIFFUSE_BORDER)
+#define BLUR_X         (DUNGEON_X + 2 * BLUR_BORDER)
+#define BLUR_Y         (DUNGEON_Y + 2 * BLUR_BORDER)
+
+/* Normalizer at each position: the sum of the kernel weights that fall *
+ * inside the dungeon, which works out the same way as the blur itself. */
+static void blur_weights(int32_t *sum, int32_t *count, int32_t n)
+{
+  int32_t i, j;
 
-typedef struct queue_node {
-  int x, y;
-  struct queue_node *next;
-} queue_node_t;
+  for (i = 0; i < n; i++) {
+    for (sum[i] = count[i] = 0, j = -2; j <= 2; j++) {
+      if (i + j >= 0 && i + j < n) {
+        sum[i] += gaussian[j + 2];
+        count[i] += (j >= -1 && j <= 1);
+      }
+    }
+  }
+}
 
-static int smooth_hardness(dungeon *d)
-{
-  int32_t i, x, y;
-  int32_t s, t, p, q;
-  queue_node_t *head, *tail, *tmp;
 #if DUMP_HARDNESS_IMAGES
+static void dump_hardness(const char *name, int32_t w, int32_t h,
+                          const uint8_t *row, int32_t stride)
+{
   FILE *out;
+  int32_t y;
+
+  out = fopen(name, "w");
+  fprintf(out, "P5\n%u %u\n255\n", w, h);
+  for (y = 0; y < h; y++) {
+    fwrite(row + y * stride, w, 1, out);
+  }
+  fclose(out);
+}
 #endif
-  uint8_t hardness[DUNGEON_Y][DUNGEON_X];
 
-  memset(&hardness, 0, sizeof (hardness));
+static int smooth_hardness(dungeon *d)
+{
+  int32_t i, x, y;
+  uint32_t head, tail, at;
+  int32_t w = dungeon_x(d), h = dungeon_y(d);
+  /* Every cell is queued exactly once, when it gets its value, so the *
+   * queue never needs more room than there are cells.                 */
+  dungeon_grid<cell_index_t> queue(w, h);
+  dungeon_grid<uint8_t, DIFFUSE_X, DIFFUSE_Y>
+    hardness(w + 2 * DIFFUSE_BORDER, h + 2 * DIFFUSE_BORDER);
+  uint8_t *cell;
+  dungeon_grid<int32_t, BLUR_X, BLUR_Y>
+    src(w + 2 * BLUR_BORDER, h + 2 * BLUR_BORDER);
+  dungeon_grid<int32_t, DUNGEON_X, BLUR_Y> across(w, h + 2 * BLUR_BORDER);
+  /* Row 0 is the kernel sums, row 1 the 3-cell counts. */
+  dungeon_grid<int32_t, DUNGEON_X, 2> weight_x(w, 2);
+  dungeon_grid<int32_t, DUNGEON_Y, 2> weight_y(h, 2);
+  int32_t t;
+  /* Offsets to the eight neighbors, in the order the diffusion has *
+   * always visited them, since that order decides ties.            */
+  const int32_t s = hardness.stride();
+  const int32_t neighbor[8] = {
+    -s - 1, -1, s - 1,
+    -s,         s,
+    -s + 1,  1, s + 1
+  };
+
+  hardness.fill(0xff);
+  for (y = 0; y < h; y++) {
+    memset(&hardness[y + DIFFUSE_BORDER][DIFFUSE_BORDER], 0, w);
+  }
+  cell = hardness.data();
 
   /* Seed with some values */
-  for (i = 1; i < 255; i += 20) {
+  for (head = tail = 0, i = 1; i < 255; i += 20) {
     do {
-      x = rand() % DUNGEON_X;
-      y = rand() % DUNGEON_Y;
-    } while (hardness[y][x]);
-    hardness[y][x] = i;
-    if (i == 1) {
-      head = tail = (queue_node_t *) malloc(sizeof (*tail));
-    } else {
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-    }
-    tail->next = NULL;
-    tail->x = x;
-    tail->y = y;
+      x = rng_below(d->rng + rng_level, w);
+      y = rng_below(d->rng + rng_level, h);
+    } while (hardness[y + DIFFUSE_BORDER][x + DIFFUSE_BORDER]);
+    hardness[y + DIFFUSE_BORDER][x + DIFFUSE_BORDER] = i;
+    queue.data()[tail++] = (y + DIFFUSE_BORDER) * s + x + DIFFUSE_BORDER;
   }
 
 #if DUMP_HARDNESS_IMAGES
-  out = fopen("seeded.pgm", "w");
-  fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&hardness, sizeof (hardness), 1, out);
-  fclose(out);
+  dump_hardness("seeded.pgm", w, h,
+                &hardness[DIFFUSE_BORDER][DIFFUSE_BORDER], s);
 #endif
   
   /* Diffuse the vaules to fill the space */
-  while (head) {
-    x = head->x;
-    y = head->y;
-    i = hardness[y][x];
-
-    if (x - 1 >= 0 && y - 1 >= 0 && !hardness[y - 1][x - 1]) {
-      hardness[y - 1][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y - 1;
-    }
-    if (x - 1 >= 0 && !hardness[y][x - 1]) {
-      hardness[y][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y;
-    }
-    if (x - 1 >= 0 && y + 1 < DUNGEON_Y && !hardness[y + 1][x - 1]) {
-      hardness[y + 1][x - 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x - 1;
-      tail->y = y + 1;
-    }
-    if (y - 1 >= 0 && !hardness[y - 1][x]) {
-      hardness[y - 1][x] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x;
-      tail->y = y - 1;
-    }
-    if (y + 1 < DUNGEON_Y && !hardness[y + 1][x]) {
-      hardness[y + 1][x] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x;
-      tail->y = y + 1;
-    }
-    if (x + 1 < DUNGEON_X && y - 1 >= 0 && !hardness[y - 1][x + 1]) {
-      hardness[y - 1][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y - 1;
-    }
-    if (x + 1 < DUNGEON_X && !hardness[y][x + 1]) {
-      hardness[y][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y;
-    }
-    if (x + 1 < DUNGEON_X && y + 1 < DUNGEON_Y && !hardness[y + 1][x + 1]) {
-      hardness[y + 1][x + 1] = i;
-      tail->next = (queue_node_t *) malloc(sizeof (*tail));
-      tail = tail->next;
-      tail->next = NULL;
-      tail->x = x + 1;
-      tail->y = y + 1;
+  while (head < tail) {
+    at = queue.data()[head++];
+    for (i = 0; i < 8; i++) {
+      if (!cell[at + neighbor[i]]) {
+        cell[at + neighbor[i]] = cell[at];
+        queue.data()[tail++] = at + neighbor[i];
+      }
     }
-
-    tmp = head;
-    head = head->next;
-    free(tmp);
   }
 
-  /* And smooth it a bit with a gaussian convolution */
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      for (s = t = p = 0; p < 5; p++) {
-        for (q = 0; q < 5; q++) {
-          if (y + (p - 2) >= 0 && y + (p - 2) < DUNGEON_Y &&
-              x + (q - 2) >= 0 && x + (q - 2) < DUNGEON_X) {
-            s += gaussian[p][q];
-            t += hardness[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
-          }
-        }
-      }
-      d->hardness[y][x] = t / s;
+  /* And smooth it a bit with a gaussian convolution.  (This used to be *
+   * done twice, but both passes read the unsmoothed values, so the     *
+   * second one only ever recomputed the first.)                        */
+  for (y = 0; y < h; y++) {
+    for (x = 0; x < w; x++) {
+      src[y + BLUR_BORDER][x + BLUR_BORDER] =
+        hardness[y + DIFFUSE_BORDER][x + DIFFUSE_BORDER];
     }
   }
-  /* Let's do it again, until it's smooth like Kenny G. */
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      for (s = t = p = 0; p < 5; p++) {
-        for (q = 0; q < 5; q++) {
-          if (y + (p - 2) >= 0 && y + (p - 2) < DUNGEON_Y &&
-              x + (q - 2) >= 0 && x + (q - 2) < DUNGEON_X) {
-            s += gaussian[p][q];
-            t += hardness[y + (p - 2)][x + (q - 2)] * gaussian[p][q];
-          }
-        }
-      }
-      d->hardness[y][x] = t / s;
+  for (y = 0; y < h + 2 * BLUR_BORDER; y++) {
+    for (x = 0; x < w; x++) {
+      across[y][x] = (gaussian[0] * src[y][x]     +
+                      gaussian[1] * src[y][x + 1] +
+                      gaussian[2] * src[y][x + 2] +
+                      gaussian[3] * src[y][x + 3] +
+                      gaussian[4] * src[y][x + 4]);
+    }
+  }
+  blur_weights(weight_x[0], weight_x[1], w);
+  blur_weights(weight_y[0], weight_y[1], h);
+  for (y = 0; y < h; y++) {
+    for (x = 0; x < w; x++) {
+      t = (gaussian[0] * across[y][x]     +
+           gaussian[1] * across[y + 1][x] +
+           gaussian[2] * across[y + 2][x] +
+           gaussian[3] * across[y + 3][x] +
+           gaussian[4] * across[y + 4][x]);
+      t -= 2 * (src[y + 2][x + 1] + src[y + 2][x + 2] + src[y + 2][x + 3]);
+      t -= 2 * (src[y + 1][x + 2] + src[y + 2][x + 2] + src[y + 3][x + 2]);
+      t -= 4 * src[y + 2][x + 2];
+      d->hardness[y][x] = t / (weight_y[0][y] * weight_x[0][x] -
+                               2 * weight_x[1][x] - 2 * weight_y[1][y] - 4);
     }
   }
 
 #if DUMP_HARDNESS_IMAGES
-  out = fopen("diffused.pgm", "w");
-  fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&hardness, sizeof (hardness), 1, out);
-  fclose(out);
-
-  out = fopen("smoothed.pgm", "w");
-  fprintf(out, "P5\n%u %u\n255\n", DUNGEON_X, DUNGEON_Y);
-  fwrite(&d->hardness, sizeof (d->hardness), 1, out);
-  fclose(out);
+  dump_hardness("diffused.pgm", w, h,
+                &hardness[DIFFUSE_BORDER][DIFFUSE_BORDER], s);
+  dump_hardness("smoothed.pgm", w, h, d->hardness.data(),
+                d->hardness.stride());
 #endif
 
   return 0;
@@ -495,14 +568,14 @@ static int smooth_hardness(dungeon *d)
 
 static int empty_dungeon(dungeon *d)
 {
-  uint8_t x, y;
+  int32_t x, y;
 
   smooth_hardness(d);
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = 0; y < dungeon_y(d); y++) {
+    for (x = 0; x < dungeon_x(d); x++) {
       mapxy(x, y) = ter_wall;
-      if (y == 0 || y == DUNGEON_Y - 1 ||
-          x == 0 || x == DUNGEON_X - 1) {
+      if (y == 0 || y == dungeon_y(d) - 1 ||
+          x == 0 || x == dungeon_x(d) - 1) {
         mapxy(x, y) = ter_wall_immutable;
         hardnessxy(x, y) = 255;
       }
@@ -514,36 +587,120 @@ static int empty_dungeon(dungeon *d)
   return 0;
 }
 
+/* Rooms need at least one cell of rock between them.  Rather than     *
+ * carving rooms as they're placed and starting over from scratch (new *
+ * hardness and all) as soon as one lands on another, we keep a bitmap *
+ * of the cells taken by the rooms placed so far, test each candidate  *
+ * position, margin included, against it a word at a time, and draw a  *
+ * new position for just the room that didn't fit.  Only if a room     *
+ * can't find a spot at all do we clear the bitmap and place them all  *
+ * again.  The rooms are carved once everything has a place.           */
+#define ROOM_BITMAP_WORDS ((DUNGEON_X + 63) / 64)
+#define room_bitmap_words(d) ((dungeon_x(d) + 63) / 64)
+#define PLACE_ROOM_TRIES  1000
+
+typedef dungeon_grid<uint64_t, ROOM_BITMAP_WORDS> room_bitmap_t;
+
+/* Bits x0 through x1, inclusive, that fall in word w of a row. */
+static inline uint64_t room_bitmap_span(int32_t w, int32_t x0, int32_t x1)
+{
+  x0 -= w * 64;
+  x1 -= w * 64;
+  if (x0 < 0) {
+    x0 = 0;
+  }
+  if (x1 > 63) {
+    x1 = 63;
+  }
+
+  return x0 > x1 ? 0 : (~0ULL >> (63 - x1)) & (~0ULL << x0);
+}
+
+/* Only the words that x0 through x1 reach are looked at, which is one *
+ * or two of them whatever the width of the level.                      */
+static uint32_t room_bitmap_test(room_bitmap_t &taken,
+                                 int32_t y0, int32_t y1,
+                                 int32_t x0, int32_t x1)
+{
+  int32_t w;
+
+  for (; y0 <= y1; y0++) {
+    for (w = x0 / 64; w <= x1 / 64; w++) {
+      if (taken[y0][w] & room_bitmap_span(w, x0, x1)) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+static void room_bitmap_set(room_bitmap_t &taken, int32_t y0, int32_t y1,
+                            int32_t x0, int32_t x1)
+{
+  int32_t w;
+
+  for (; y0 <= y1; y0++) {
+    for (w = x0 / 64; w <= x1 / 64; w++) {
+      taken[y0][w] |= room_bitmap_span(w, x0, x1);
+    }
+  }
+}
+
+static uint32_t place_room(dungeon *d, room_bitmap_t &taken, room_t *r)
+{
+  uint32_t tries;
+
+  for (tries = 0; tries < PLACE_ROOM_TRIES; tries++) {
+    d->gen_stats.room_attempts++;
+    r->position[dim_x] = 1 + rng_below(d->rng + rng_level,
+                                       dungeon_x(d) - 2 - r->size[dim_x]);
+    r->position[dim_y] = 1 + rng_below(d->rng + rng_level,
+                                       dungeon_y(d) - 2 - r->size[dim_y]);
+    if (!room_bitmap_test(taken,
+                          r->position[dim_y] - 1,
+                          r->position[dim_y] + r->size[dim_y],
+                          r->position[dim_x] - 1,
+                          r->position[dim_x] + r->size[dim_x])) {
+      room_bitmap_set(taken,
+                      r->position[dim_y],
+                      r->position[dim_y] + r->size[dim_y] - 1,
+                      r->position[dim_x],
+                      r->position[dim_x] + r->size[dim_x] - 1);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
 static int place_rooms(dungeon *d)
 {
+  room_bitmap_t taken(room_bitmap_words(d), dungeon_y(d));
   pair_t p;
   uint32_t i;
-  int success;
   room_t *r;
 
-  for (success = 0; !success; ) {
-    success = 1;
-    for (i = 0; success && i < d->num_rooms; i++) {
-      r = d->rooms + i;
-      r->position[dim_x] = 1 + rand() % (DUNGEON_X - 2 - r->size[dim_x]);
-      r->position[dim_y] = 1 + rand() % (DUNGEON_Y - 2 - r->size[dim_y]);
-      for (p[dim_y] = r->position[dim_y] - 1;
-           success && p[dim_y] < r->position[dim_y] + r->size[dim_y] + 1;
-           p[dim_y]++) {
-        for (p[dim_x] = r->position[dim_x] - 1;
-             success && p[dim_x] < r->position[dim_x] + r->size[dim_x] + 1;
-             p[dim_x]++) {
-          if (mappair(p) >= ter_floor) {
-            success = 0;
-            empty_dungeon(d);
-          } else if ((p[dim_y] != r->position[dim_y] - 1)              &&
-                     (p[dim_y] != r->position[dim_y] + r->size[dim_y]) &&
-                     (p[dim_x] != r->position[dim_x] - 1)              &&
-                     (p[dim_x] != r->position[dim_x] + r->size[dim_x])) {
-            mappair(p) = ter_floor_room;
-            hardnesspair(p) = 0;
-          }
-        }
+  for (;;) {
+    taken.fill(0);
+    for (i = 0; i < d->num_rooms && place_room(d, taken, d->rooms + i); i++)
+      ;
+    if (i == d->num_rooms) {
+      break;
+    }
+    d->gen_stats.room_restarts++;
+  }
+
+  for (i = 0; i < d->num_rooms; i++) {
+    r = d->rooms + i;
+    for (p[dim_y] = r->position[dim_y];
+         p[dim_y] < r->position[dim_y] + r->size[dim_y];
+         p[dim_y]++) {
+      for (p[dim_x] = r->position[dim_x];
+           p[dim_x] < r->position[dim_x] + r->size[dim_x];
+           p[dim_x]++) {
+        mappair(p) = ter_floor_room;
+        hardnesspair(p) = 0;
       }
     }
   }
@@ -555,40 +712,56 @@ static void place_stairs(dungeon *d)
 {
   pair_t p;
   do {
-    while ((p[dim_y] = rand_range(1, DUNGEON_Y - 2)) &&
-           (p[dim_x] = rand_range(1, DUNGEON_X - 2)) &&
+    while ((p[dim_y] = rand_range(d->rng + rng_level, 1,
+                                  dungeon_y(d) - 2)) &&
+           (p[dim_x] = rand_range(d->rng + rng_level, 1,
+                                   dungeon_x(d) - 2)) &&
            ((mappair(p) < ter_floor)                 ||
             (mappair(p) > ter_stairs)))
       ;
     mappair(p) = ter_stairs_down;
-  } while (rand_under(1, 3));
+  } while (rand_under(d->rng + rng_level, 1, 3));
   do {
-    while ((p[dim_y] = rand_range(1, DUNGEON_Y - 2)) &&
-           (p[dim_x] = rand_range(1, DUNGEON_X - 2)) &&
+    while ((p[dim_y] = rand_range(d->rng + rng_level, 1,
+                                  dungeon_y(d) - 2)) &&
+           (p[dim_x] = rand_range(d->rng + rng_level, 1,
+                                   dungeon_x(d) - 2)) &&
            ((mappair(p) < ter_floor)                 ||
             (mappair(p) > ter_stairs)))
       
       ;
     mappair(p) = ter_stairs_up;
-  } while (rand_under(2, 4));
+  } while (rand_under(d->rng + rng_level, 2, 4));
 }
 
+/* Bigger levels get as many rooms as that many classic levels would, *
+ * up to as many as a room_id_t can tell apart.                        */
 static int make_rooms(dungeon *d)
 {
-  uint32_t i;
+  uint32_t i, n, scale;
 
-  for (i = MIN_ROOMS; i < MAX_ROOMS && rand_under(5, 8); i++)
-    ;
-  d->num_rooms = i;
+  for (n = 0, scale = level_scale(d); scale; scale--) {
+    for (i = MIN_ROOMS;
+         i < MAX_ROOMS && rand_under(d->rng + rng_level, 5, 8);
+         i++)
+      ;
+    n += i;
+  }
+  if (n > MAX_LEVEL_ROOMS) {
+    n = MAX_LEVEL_ROOMS;
+  }
+  d->num_rooms = n;
   d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
   
   for (i = 0; i < d->num_rooms; i++) {
     d->rooms[i].size[dim_x] = ROOM_MIN_X;
     d->rooms[i].size[dim_y] = ROOM_MIN_Y;
-    while (rand_under(3, 5) && d->rooms[i].size[dim_x] < ROOM_MAX_X) {
+    while (rand_under(d->rng + rng_level, 3, 5) &&
+           d->rooms[i].size[dim_x] < ROOM_MAX_X) {
       d->rooms[i].size[dim_x]++;
     }
-    while (rand_under(3, 5) && d->rooms[i].size[dim_y] < ROOM_MAX_Y) {
+    while (rand_under(d->rng + rng_level, 3, 5) &&
+           d->rooms[i].size[dim_y] < ROOM_MAX_Y) {
       d->rooms[i].size[dim_y]++;
     }
   }
@@ -596,8 +769,45 @@ static int make_rooms(dungeon *d)
   return 0;
 }
 
+static inline uint64_t gen_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Stamps every room onto d->room_id, so that which room a cell is in, *
+ * if any, is a lookup rather than a walk over the rooms.  Has to run   *
+ * whenever the rooms change, including their order, which is why      *
+ * gen_dungeon() waits for connect_rooms() to sort them.                */
+void index_rooms(dungeon *d)
+{
+  uint32_t i;
+  int32_t x, y;
+  room_t *r;
+
+  d->room_id.fill(0);
+  for (i = 0; i < d->num_rooms; i++) {
+    r = d->rooms + i;
+    for (y = r->position[dim_y]; y < r->position[dim_y] + r->size[dim_y]; y++) {
+      for (x = r->position[dim_x];
+           x < r->position[dim_x] + r->size[dim_x];
+           x++) {
+        roomxy(x, y) = i + 1;
+      }
+    }
+  }
+}
+
 int gen_dungeon(dungeon *d)
 {
+  uint64_t start, attempts;
+
+  start = gen_clock();
+  attempts = d->gen_stats.room_attempts;
+
   empty_dungeon(d);
 
   do {
@@ -605,17 +815,51 @@ int gen_dungeon(dungeon *d)
   } while (place_rooms(d));
   connect_rooms(d);
   place_stairs(d);
+  index_rooms(d);
+  room_graph_build(d);
+
+  d->gen_stats.levels++;
+  attempts = d->gen_stats.room_attempts - attempts;
+  if (attempts > d->gen_stats.max_room_attempts) {
+    d->gen_stats.max_room_attempts = attempts;
+  }
+  start = gen_clock() - start;
+  d->gen_stats.ns += start;
+  if (start > d->gen_stats.max_ns) {
+    d->gen_stats.max_ns = start;
+  }
 
   return 0;
 }
 
+void gen_report(dungeon *d, FILE *f)
+{
+  if (!d->gen_stats.levels) {
+    return;
+  }
+
+  fprintf(f, "Levels: %u generated in %.3f ms (worst %.3f ms); "
+          "%llu room placement attempts (worst %u on one level), "
+          "%u restarts; %llu cells searched for corridors.\n",
+          d->gen_stats.levels, d->gen_stats.ns / 1e6,
+          d->gen_stats.max_ns / 1e6,
+          (unsigned long long) d->gen_stats.room_attempts,
+          d->gen_stats.max_room_attempts, d->gen_stats.room_restarts,
+          (unsigned long long) d->gen_stats.corridor_cells);
+  if (d->gen_stats.prefetched) {
+    fprintf(f, "Stairs: %u levels generated ahead, %.3f ms waited for "
+            "them (worst %.3f ms).\n", d->gen_stats.prefetched,
+            d->gen_stats.wait_ns / 1e6, d->gen_stats.max_wait_ns / 1e6);
+  }
+}
+
 void render_dungeon(dungeon *d)
 {
   pair_t p;
 
   putchar('\n');
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+  for (p[dim_y] = 0; p[dim_y] < dungeon_y(d); p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < dungeon_x(d); p[dim_x]++) {
       if (charpair(p)) {
         putchar(charpair(p)->symbol);
       } else {
@@ -652,21 +896,197 @@ void render_dungeon(dungeon *d)
   putchar('\n');
 }
 
-void delete_dungeon(dungeon *d)
+/* Taking the stairs used to stall the game for as long as it took to   *
+ * generate the next level.  Instead, as soon as a level is set up, we  *
+ * start generating its successor on a thread of its own, in a scratch  *
+ * dungeon holding a copy of the level generator, and the stairs just   *
+ * swap the result in.  Nothing but level setup draws from rng_level,   *
+ * so the copy is exactly where new_dungeon() would otherwise have      *
+ * started, and the level comes out the same either way.  Up and down   *
+ * lead to the same kind of fresh level, so one level serves both.      *
+ * The monsters and objects are still placed when the PC arrives, since *
+ * which of them may appear depends on what has happened by then.       *
+ * It's up to the caller to start it off; batch runs that already keep  *
+ * every core busy are better off without it.                           */
+struct level_pregen {
+  pthread_t thread;
+  dungeon *level;
+};
+
+static void *pregen_worker(void *v)
 {
+  dungeon *level = (dungeon *) v;
+
+  /* What init_dungeon() and gen_dungeon() would have done. */
+  empty_dungeon(level);
+  gen_dungeon(level);
+
+  return NULL;
+}
+
+void pregen_level(dungeon *d)
+{
+  level_pregen_t *p;
+
+  if (d->pregen) {
+    return;
+  }
+
+  p = (level_pregen_t *) malloc(sizeof (*p));
+  p->level = new dungeon;
+  size_dungeon(p->level, dungeon_x(d), dungeon_y(d));
+  p->level->rng[rng_level] = d->rng[rng_level];
+  if (pthread_create(&p->thread, NULL, pregen_worker, p->level)) {
+    /* No thread; the stairs will just have to generate it themselves. */
+    delete p->level;
+    free(p);
+    return;
+  }
+  d->pregen = p;
+}
+
+/* Waits for the level in progress, if there is one, and hands it over. */
+static dungeon *pregen_finish(dungeon *d)
+{
+  dungeon *level;
+  uint64_t wait;
+
+  if (!d->pregen) {
+    return NULL;
+  }
+
+  wait = gen_clock();
+  pthread_join(d->pregen->thread, NULL);
+  wait = gen_clock() - wait;
+  d->gen_stats.wait_ns += wait;
+  if (wait > d->gen_stats.max_wait_ns) {
+    d->gen_stats.max_wait_ns = wait;
+  }
+
+  level = d->pregen->level;
+  free(d->pregen);
+  d->pregen = NULL;
+
+  return level;
+}
+
+static void pregen_discard(dungeon *d)
+{
+  dungeon *level;
+
+  if ((level = pregen_finish(d))) {
+    room_graph_delete(level);
+    free(level->rooms);
+    delete level;
+  }
+}
+
+/* Moves a finished level's terrain, rooms, and room graph into d, in *
+ * place of empty_dungeon() and gen_dungeon(), and disposes of the     *
+ * rest.                                                               */
+static void pregen_install(dungeon *d, dungeon *level)
+{
+  d->num_rooms = level->num_rooms;
+  d->rooms = level->rooms;
+  d->room_graph = level->room_graph;
+  d->room_id.copy(level->room_id);
+  d->map.copy(level->map);
+  d->hardness.copy(level->hardness);
+  d->rng[rng_level] = level->rng[rng_level];
+  d->is_new = 1;
+
+  d->gen_stats.levels += level->gen_stats.levels;
+  d->gen_stats.room_attempts += level->gen_stats.room_attempts;
+  d->gen_stats.room_restarts += level->gen_stats.room_restarts;
+  d->gen_stats.corridor_cells += level->gen_stats.corridor_cells;
+  d->gen_stats.ns += level->gen_stats.ns;
+  if (level->gen_stats.max_room_attempts > d->gen_stats.max_room_attempts) {
+    d->gen_stats.max_room_attempts = level->gen_stats.max_room_attempts;
+  }
+  if (level->gen_stats.max_ns > d->gen_stats.max_ns) {
+    d->gen_stats.max_ns = level->gen_stats.max_ns;
+  }
+  d->gen_stats.prefetched++;
+
+  delete level;
+}
+
+/* Everything delete_dungeon() tears down but the level being *
+ * generated ahead, which the next new level may still want.  */
+void delete_dungeon_contents(dungeon *d)
+{
+  room_graph_delete(d);
   free(d->rooms);
-  heap_delete(&d->events);
-  memset(d->character_map, 0, sizeof (d->character_map));
+  event_queue_delete(&d->events);
+  d->character_map.fill(NULL);
   destroy_objects(d);
+  path_delete(d);
+}
+
+void delete_dungeon(dungeon *d)
+{
+  pregen_discard(d);
+  delete_dungeon_contents(d);
+}
+
+/* Sets up every one of the dungeon's generators from a single seed. */
+void seed_dungeon(dungeon *d, uint64_t seed)
+{
+  rng_t root;
+  uint32_t i;
+
+  rng_seed(&root, seed);
+  for (i = 0; i < num_rng_streams; i++) {
+    rng_split(&root, d->rng + i);
+  }
+}
+
+/* Bytes a distance needs on an x by y level.  Tunneling costs at most  *
+ * 3 a king's move, so tunneling distances never pass 3 * max(x, y);     *
+ * corridors can wind, though, and the only sure bound on walking is the *
+ * number of cells.  Classic levels have always had a byte, saturating   *
+ * at 255, and never need more: tunnels across them come to at most      *
+ * 231, and no walk through their rooms and corridors runs near 255.     */
+static uint32_t distance_width(int32_t x, int32_t y)
+{
+  if (x == DUNGEON_X && y == DUNGEON_Y) {
+    return sizeof (uint8_t);
+  }
+  if ((uint32_t) x * y < UINT16_MAX) {
+    return sizeof (uint16_t);
+  }
+
+  return sizeof (uint32_t);
+}
+
+/* Sizes every grid of a level; it's up to the caller to do so before *
+ * init_dungeon(), and before there's a PC.  Every level of a dungeon *
+ * is the same size.                                                  */
+void size_dungeon(dungeon *d, int16_t x, int16_t y)
+{
+  d->map.resize(x, y);
+  d->hardness.resize(x, y);
+  d->room_id.resize(x, y);
+  d->pc_distance.resize(dungeon_stride(d), y, distance_width(x, y));
+  d->pc_tunnel.resize(dungeon_stride(d), y, distance_width(x, y));
+  d->pc_downhill.resize(x, y);
+  d->character_map.resize(x, y);
+  d->objmap.resize(x, y);
+}
+
+/* Everything init_dungeon() sets up but the terrain. */
+void init_dungeon_contents(dungeon *d)
+{
+  event_queue_init(&d->events, d->time);
+  d->character_map.fill(NULL);
+  d->objmap.fill(NULL);
+  path_init(d);
 }
 
 void init_dungeon(dungeon *d)
 {
   empty_dungeon(d);
-  memset(&d->events, 0, sizeof (d->events));
-  heap_init(&d->events, compare_events, event_delete);
-  memset(d->character_map, 0, sizeof (d->character_map));
-  memset(d->objmap, 0, sizeof (d->objmap));
+  init_dungeon_contents(d);
 }
 
 int write_dungeon_map(dungeon *d, FILE *f)
@@ -706,11 +1126,11 @@ int write_rooms(dungeon *d, FILE *f)
 
 uint16_t count_up_stairs(dungeon *d)
 {
-  uint32_t x, y;
+  int32_t x, y;
   uint16_t i;
 
-  for (i = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
+  for (i = 0, y = 1; y < dungeon_y(d) - 1; y++) {
+    for (x = 1; x < dungeon_x(d) - 1; x++) {
       if (mapxy(x, y) == ter_stairs_up) {
         i++;
       }
@@ -722,11 +1142,11 @@ uint16_t count_up_stairs(dungeon *d)
 
 uint16_t count_down_stairs(dungeon *d)
 {
-  uint32_t x, y;
+  int32_t x, y;
   uint16_t i;
 
-  for (i = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
+  for (i = 0, y = 1; y < dungeon_y(d) - 1; y++) {
+    for (x = 1; x < dungeon_x(d) - 1; x++) {
       if (mapxy(x, y) == ter_stairs_down) {
         i++;
       }
@@ -779,13 +1199,58 @@ uint32_t calculate_dungeon_size(dungeon *d)
           (count_down_stairs(d) * 2));
 }
 
+/* Everything write_dungeon() puts in a save file, written to f, which *
+ * may already have other things in it.  The PC is taken as a position *
+ * so that levels can be saved before there's a PC to put on them.     */
+int write_dungeon_record(dungeon *d, pair_t pc, FILE *f)
+{
+  uint32_t be32;
+
+  /* The semantic, which is 6 bytes, 0-11 */
+  fwrite(DUNGEON_SAVE_SEMANTIC, 1, sizeof (DUNGEON_SAVE_SEMANTIC) - 1, f);
+
+  /* The version, 4 bytes, 12-15 */
+  be32 = htobe32(DUNGEON_SAVE_VERSION);
+  fwrite(&be32, sizeof (be32), 1, f);
+
+  /* The size of the file, 4 bytes, 16-19 */
+  be32 = htobe32(calculate_dungeon_size(d));
+  fwrite(&be32, sizeof (be32), 1, f);
+
+  /* The PC position, 2 bytes, 20-21 */
+  fwrite(&pc[dim_x], 1, 1, f);
+  fwrite(&pc[dim_y], 1, 1, f);
+
+  /* The dungeon map, 1680 bytes, 22-1702 */
+  write_dungeon_map(d, f);
+
+  /* The rooms, num_rooms * 4 bytes, 1703-end */
+  write_rooms(d, f);
+
+  /* And the stairs */
+  write_stairs(d, f);
+
+  return 0;
+}
+
+/* Save files and PGMs have no room for any other dimensions. */
+static void require_classic_size(dungeon *d, const char *what)
+{
+  if (dungeon_x(d) != DUNGEON_X || dungeon_y(d) != DUNGEON_Y) {
+    fprintf(stderr, "Only %dx%d levels can be %s.\n",
+            DUNGEON_X, DUNGEON_Y, what);
+    exit(-1);
+  }
+}
+
 int write_dungeon(dungeon *d, char *file)
 {
   const char *home;
   char *filename;
   FILE *f;
   size_t len;
-  uint32_t be32;
+
+  require_classic_size(d, "saved");
 
   if (!file) {
     if (!(home = getenv("HOME"))) {
@@ -816,29 +1281,7 @@ int write_dungeon(dungeon *d, char *file)
     }
   }
 
-  /* The semantic, which is 6 bytes, 0-11 */
-  fwrite(DUNGEON_SAVE_SEMANTIC, 1, sizeof (DUNGEON_SAVE_SEMANTIC) - 1, f);
-
-  /* The version, 4 bytes, 12-15 */
-  be32 = htobe32(DUNGEON_SAVE_VERSION);
-  fwrite(&be32, sizeof (be32), 1, f);
-
-  /* The size of the file, 4 bytes, 16-19 */
-  be32 = htobe32(calculate_dungeon_size(d));
-  fwrite(&be32, sizeof (be32), 1, f);
-
-  /* The PC position, 2 bytes, 20-21 */
-  fwrite(&d->PC->position[dim_x], 1, 1, f);
-  fwrite(&d->PC->position[dim_y], 1, 1, f);
-
-  /* The dungeon map, 1680 bytes, 22-1702 */
-  write_dungeon_map(d, f);
-
-  /* The rooms, num_rooms * 4 bytes, 1703-end */
-  write_rooms(d, f);
-
-  /* And the stairs */
-  write_stairs(d, f);
+  write_dungeon_record(d, d->PC->position, f);
 
   fclose(f);
 
@@ -902,6 +1345,8 @@ int read_rooms(dungeon *d, FILE *f)
   d->rooms = (room_t *) malloc(sizeof (*d->rooms) * d->num_rooms);
 
   for (i = 0; i < d->num_rooms; i++) {
+    /* Single bytes, so clear what's left of the room count first. */
+    p = 0;
     fread(&p, 1, 1, f);
     d->rooms[i].position[dim_x] = p;
     fread(&p, 1, 1, f);
@@ -959,6 +1404,8 @@ int read_dungeon(dungeon *d, char *file)
   char *filename;
   struct stat buf;
 
+  require_classic_size(d, "loaded");
+
   if (!file) {
     if (!(home = getenv("HOME"))) {
       fprintf(stderr, "\"HOME\" is undefined.  Using working directory.\n");
@@ -1015,12 +1462,14 @@ int read_dungeon(dungeon *d, char *file)
     exit(-1);
   }
 
-  fread(&d->PC->position[dim_x], 1, 1, f);
-  fread(&d->PC->position[dim_y], 1, 1, f);
-  
+  /* There's no PC yet; config_pc() places one afterward, wherever it *
+   * likes, so the saved position is skipped.                         */
+  fseek(f, 2, SEEK_CUR);
+
   read_dungeon_map(d, f);
 
   read_rooms(d, f);
+  index_rooms(d);
 
   read_stairs(d, f);
 
@@ -1039,6 +1488,8 @@ int read_pgm(dungeon *d, char *pgm)
   uint32_t i;
   char size[8]; /* Big enough to hold two 3-digit values with a space between. */
 
+  require_classic_size(d, "loaded");
+
   if (!(f = fopen(pgm, "r"))) {
     perror(pgm);
     exit(-1);
@@ -1111,6 +1562,7 @@ int read_pgm(dungeon *d, char *pgm)
     d->map[y][DUNGEON_X - 1] = ter_wall_immutable;
     d->hardness[y][DUNGEON_X - 1] = 255;
   }
+  index_rooms(d);
 
   return 0;
 }
@@ -1125,13 +1577,13 @@ void render_hardness_map(dungeon *d)
   
   putchar('\n');
   printf("   ");
-  for (i = 0; i < DUNGEON_X; i++) {
+  for (i = 0; i < dungeon_x(d); i++) {
     printf("%2d", i);
   }
   putchar('\n');
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
+  for (p[dim_y] = 0; p[dim_y] < dungeon_y(d); p[dim_y]++) {
     printf("%2d ", p[dim_y]);
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+    for (p[dim_x] = 0; p[dim_x] < dungeon_x(d); p[dim_x]++) {
       printf("%02x", hardnesspair(p));
     }
     putchar('\n');
@@ -1143,8 +1595,8 @@ void render_movement_cost_map(dungeon *d)
   pair_t p;
 
   putchar('\n');
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+  for (p[dim_y] = 0; p[dim_y] < dungeon_y(d); p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < dungeon_x(d); p[dim_x]++) {
       if (p[dim_x] ==  d->PC->position[dim_x] &&
           p[dim_y] ==  d->PC->position[dim_y]) {
         putchar('@');
@@ -1164,8 +1616,10 @@ void render_distance_map(dungeon *d)
 {
   pair_t p;
 
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+  path_ensure(d, path_walk);
+
+  for (p[dim_y] = 0; p[dim_y] < dungeon_y(d); p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < dungeon_x(d); p[dim_x]++) {
       if (p[dim_x] ==  d->PC->position[dim_x] &&
           p[dim_y] ==  d->PC->position[dim_y]) {
         putchar('@');
@@ -1182,10 +1636,11 @@ void render_distance_map(dungeon *d)
         case ter_stairs_up:
         case ter_stairs_down:
           /* Placing X for infinity */
-          if (d->pc_distance[p[dim_y]][p[dim_x]] == UCHAR_MAX) {
+          if (d->pc_distance.at(p[dim_x], p[dim_y]) ==
+              d->pc_distance.infinity()) {
             putchar('X');
           } else {
-            putchar('0' + d->pc_distance[p[dim_y]][p[dim_x]] % 10);
+            putchar('0' + d->pc_distance.at(p[dim_x], p[dim_y]) % 10);
           }
           break;
         case ter_debug:
@@ -1205,8 +1660,10 @@ void render_tunnel_distance_map(dungeon *d)
 {
   pair_t p;
 
-  for (p[dim_y] = 0; p[dim_y] < DUNGEON_Y; p[dim_y]++) {
-    for (p[dim_x] = 0; p[dim_x] < DUNGEON_X; p[dim_x]++) {
+  path_ensure(d, path_tunnel);
+
+  for (p[dim_y] = 0; p[dim_y] < dungeon_y(d); p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < dungeon_x(d); p[dim_x]++) {
       if (p[dim_x] ==  d->PC->position[dim_x] &&
           p[dim_y] ==  d->PC->position[dim_y]) {
         putchar('@');
@@ -1223,10 +1680,10 @@ void render_tunnel_distance_map(dungeon *d)
         case ter_stairs_up:
         case ter_stairs_down:
           /* Placing X for infinity */
-          if (d->pc_tunnel[p[dim_y]][p[dim_x]] == UCHAR_MAX) {
+          if (d->pc_tunnel.at(p[dim_x], p[dim_y]) == d->pc_tunnel.infinity()) {
             putchar('X');
           } else {
-            putchar('0' + d->pc_tunnel[p[dim_y]][p[dim_x]] % 10);
+            putchar('0' + d->pc_tunnel.at(p[dim_x], p[dim_y]) % 10);
           }
           break;
         case ter_debug:
@@ -1245,13 +1702,21 @@ void render_tunnel_distance_map(dungeon *d)
 void new_dungeon(dungeon *d)
 {
   uint32_t sequence_number;
+  dungeon *next;
 
   sequence_number = d->character_sequence_number;
 
+  next = pregen_finish(d);
+
   delete_dungeon(d);
 
-  init_dungeon(d);
-  gen_dungeon(d);
+  if (next) {
+    init_dungeon_contents(d);
+    pregen_install(d, next);
+  } else {
+    init_dungeon(d);
+    gen_dungeon(d);
+  }
   d->character_sequence_number = sequence_number;
 
   place_pc(d);
@@ -1259,4 +1724,9 @@ void new_dungeon(dungeon *d)
 
   gen_monsters(d);
   gen_objects(d);
+
+  /* Whoever started generating ahead wants it to keep going. */
+  if (next) {
+    pregen_level(d);
+  }
 }
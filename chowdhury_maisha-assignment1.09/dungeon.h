@@ -5,13 +5,19 @@
 
 # include "heap.h"
 # include "dims.h"
+# include "grid.h"
 # include "character.h"
 # include "descriptions.h"
+# include "path.h"
+# include "event.h"
+# include "move.h"
+# include "autopilot.h"
 
 #define DUNGEON_X              80
 #define DUNGEON_Y              21
 #define MIN_ROOMS              6
 #define MAX_ROOMS              10
+#define MAX_LEVEL_ROOMS        UINT16_MAX
 #define ROOM_MIN_X             4
 #define ROOM_MIN_Y             3
 #define ROOM_MAX_X             20
@@ -25,13 +31,97 @@
 #define MAX_OBJECTS            15
 #define SAVE_DIR               ".rlg327"
 #define DUNGEON_SAVE_FILE      "dungeon"
-#define DUNGEON_SAVE_SEMANTIC  "RLG327-"
+#define DUNGEON_SAVE_SEMANTIC  "RLG327-" TERM
 #define DUNGEON_SAVE_VERSION   0U
+#define DUNGEON_PACK_SEMANTIC  "RLG327-PACK"
+#define DUNGEON_PACK_VERSION   0U
 #define MONSTER_DESC_FILE      "monster_desc.txt"
 #define OBJECT_DESC_FILE       "object_desc.txt"
 
 #define INVENTORY_SIZE 10////
 
+/* Set to 1 to size levels at run time (see --dimensions); the Makefile *
+ * does, for rlg327-big.  Otherwise, every level is DUNGEON_X by         *
+ * DUNGEON_Y, every grid below is a plain array of that size, and the    *
+ * dimensions are constants everywhere they are used.  The screen always *
+ * shows DUNGEON_X by DUNGEON_Y cells.                                   */
+#ifndef DUNGEON_GRID_DYNAMIC
+# define DUNGEON_GRID_DYNAMIC 0
+#endif
+
+/* A grid the size of a level, or, given X and Y, some other size that *
+ * classic levels use; run-time sized grids are resized by their user. *
+ * A cell index is a flat index into any of them.                      */
+#if DUNGEON_GRID_DYNAMIC
+template <class T, int32_t X = DUNGEON_X, int32_t Y = DUNGEON_Y>
+using dungeon_grid = grid<T>;
+typedef uint32_t cell_index_t;
+#else
+template <class T, int32_t X = DUNGEON_X, int32_t Y = DUNGEON_Y>
+using dungeon_grid = grid<T, X, Y>;
+typedef uint16_t cell_index_t;
+#endif
+
+/* The PC's distance maps, in cells no wider than the level needs: one,  *
+ * two, or four bytes, set by size_dungeon().  The path engine works on  *
+ * the cells as whichever type they are; everything else reads them with *
+ * at(), which widens, and compares against infinity(), the value of     *
+ * cells that are out of reach.  Rows are as many bytes wide as the      *
+ * level's stride is cells, times the width, so flat indices carry over. *
+ * Every cell in reach holds its distance plus the map's bias, which     *
+ * at() takes back off; see repair_map() in path.cpp.                    */
+class distance_grid {
+ private:
+  dungeon_grid<uint8_t> bytes;
+  uint32_t w;
+  uint32_t b;
+ public:
+  distance_grid(int32_t x, int32_t y) : bytes(x, y), w(1), b(0) {}
+  inline uint32_t width() const { return w; }
+  inline uint32_t infinity() const { return UINT32_MAX >> (32 - 8 * w); }
+  inline uint32_t bias() const { return b; }
+  inline void set_bias(uint32_t bias) { b = bias; }
+  inline uint32_t size() const { return bytes.size(); }
+  template <class D> inline D *cells() { return (D *) bytes.data(); }
+  inline uint32_t at(int32_t x, int32_t y) const
+  {
+    const uint8_t *row = bytes[y];
+    uint32_t v;
+
+    switch (w) {
+    case 1:
+      v = row[x];
+      break;
+    case 2:
+      v = ((const uint16_t *) row)[x];
+      break;
+    default:
+      v = ((const uint32_t *) row)[x];
+      break;
+    }
+
+    return v == infinity() ? v : v - b;
+  }
+  void resize(int32_t stride, int32_t y, uint32_t width)
+  {
+    bytes.resize(stride * width, y);
+    w = width;
+    b = 0;
+  }
+  void copy(const distance_grid &g)
+  {
+    bytes.copy(g.bytes);
+    w = g.w;
+    b = g.b;
+  }
+};
+
+#define dungeon_x(d) ((d)->map.width())
+#define dungeon_y(d) ((d)->map.height())
+#define dungeon_stride(d) ((d)->map.stride())
+#define dungeon_cells(d) ((d)->map.size())
+#define cell_index(d, x, y) ((y) * dungeon_stride(d) + (x))
+
 #define mappair(pair) (d->map[pair[dim_y]][pair[dim_x]])
 #define mapxy(x, y) (d->map[y][x])
 #define hardnesspair(pair) (d->hardness[pair[dim_y]][pair[dim_x]])
@@ -40,6 +130,8 @@
 #define charxy(x, y) (d->character_map[y][x])
 #define objpair(pair) (d->objmap[pair[dim_y]][pair[dim_x]])
 #define objxy(x, y) (d->objmap[y][x])
+#define roompair(pair) (d->room_id[pair[dim_y]][pair[dim_x]])
+#define roomxy(x, y) (d->room_id[y][x])
 
 enum __attribute__ ((__packed__)) terrain_type {
   ter_debug,
@@ -59,19 +151,73 @@ typedef struct room {
   pair_t size;
 } room_t;
 
+/* One more than a room's index, or zero for no room.  Levels never *
+ * have more than MAX_LEVEL_ROOMS rooms, so every room has one.     */
+typedef uint16_t room_id_t;
+
 class pc;
 class object;
 
+/* Each subsystem draws from its own generator, so that a change in how *
+ * many numbers one of them uses leaves the others' sequences alone.    */
+typedef enum rng_stream {
+  rng_level,   /* Dungeon layout, and the monsters and objects on it */
+  rng_npc,     /* Monster movement                                   */
+  rng_pc,      /* The PC's random choices, and the autopilot's       */
+  rng_combat,  /* Who gets eaten, and how                            */
+  num_rng_streams
+} rng_stream_t;
+
+/* What level generation has cost so far, over every level this dungeon *
+ * has had.  An attempt is one candidate position drawn for one room; a *
+ * restart is a level on which some room found no place at all, sending *
+ * every room back to be placed again.  Corridor cells count the cells  *
+ * taken off the corridor router's queue.  Prefetched levels were ready *
+ * (or on their way) before the PC took the stairs; the wait is how     *
+ * long the stairs then took to get them.                               */
+typedef struct gen_stats {
+  uint32_t levels;
+  uint64_t room_attempts;
+  uint32_t room_restarts;
+  uint32_t max_room_attempts;
+  uint64_t corridor_cells;
+  uint64_t ns;
+  uint64_t max_ns;
+  uint32_t prefetched;
+  uint64_t wait_ns;
+  uint64_t max_wait_ns;
+} gen_stats_t;
+
+/* The next level, being generated in the background; opaque outside *
+ * of dungeon.cpp.                                                   */
+typedef struct level_pregen level_pregen_t;
+
+/* The floors the PC has left behind; opaque outside of level.cpp. */
+typedef struct level_store level_store_t;
+
+/* Rooms and the corridors between them, for long routes on big *
+ * levels; opaque outside of roomgraph.cpp.                      */
+typedef struct room_graph room_graph_t;
+
 class dungeon {
  public:
-  dungeon() : num_rooms(0), rooms(0), map{ter_wall}, hardness{0},
-              pc_distance{0}, pc_tunnel{0}, character_map{0}, PC(0),
+  dungeon() : num_rooms(0), rooms(0), room_id(DUNGEON_X, DUNGEON_Y),
+              map(DUNGEON_X, DUNGEON_Y),
+              hardness(DUNGEON_X, DUNGEON_Y),
+              pc_distance(DUNGEON_X, DUNGEON_Y),
+              pc_tunnel(DUNGEON_X, DUNGEON_Y),
+              pc_downhill(DUNGEON_X, DUNGEON_Y), paths(),
+              character_map(DUNGEON_X, DUNGEON_Y),
+              objmap(DUNGEON_X, DUNGEON_Y), PC(0), stats(), gen_stats(),
               num_monsters(0), max_monsters(0), character_sequence_number(0),
-              time(0), is_new(0), quit(0), monster_descriptions(),
-              object_descriptions() {}
+              time(0), is_new(0), quit(0), controller(0), rng{}, pregen(0),
+              depth(0), levels(0), level_budget(0), room_graph(0),
+              monster_descriptions(), object_descriptions() {}
   uint32_t num_rooms;
   room_t *rooms;
-  terrain_type map[DUNGEON_Y][DUNGEON_X];
+  /* The room each cell is in; see index_rooms(). */
+  dungeon_grid<room_id_t> room_id;
+  dungeon_grid<terrain_type> map;
   /* Since hardness is usually not used, it would be expensive to pull it *
    * into cache every time we need a map cell, so we store it in a        *
    * parallel array, rather than using a structure to represent the       *
@@ -80,13 +226,18 @@ class dungeon {
    * that structure.  Pathfinding will require efficient use of the map,  *
    * and pulling in unnecessary data with each map cell would add a lot   *
    * of overhead to the memory system.                                    */
-  uint8_t hardness[DUNGEON_Y][DUNGEON_X];
-  uint8_t pc_distance[DUNGEON_Y][DUNGEON_X];
-  uint8_t pc_tunnel[DUNGEON_Y][DUNGEON_X];
-  character *character_map[DUNGEON_Y][DUNGEON_X];
-  object *objmap[DUNGEON_Y][DUNGEON_X];
+  dungeon_grid<uint8_t> hardness;
+  distance_grid pc_distance;
+  distance_grid pc_tunnel;
+  dungeon_grid<uint8_t> pc_downhill;
+  path_state_t paths;
+  dungeon_grid<character *> character_map;
+  dungeon_grid<object *> objmap;
   pc *PC;
-  heap_t events;
+  event_queue_t events;
+  event pc_event;
+  move_stats_t stats;
+  gen_stats_t gen_stats;
   uint16_t num_monsters;
   uint16_t max_monsters;
   uint16_t num_objects;
@@ -100,16 +251,35 @@ class dungeon {
   uint32_t time;
   uint32_t is_new;
   uint32_t quit;
+  /* Takes the PC's turns when nobody is at the keyboard. */
+  const pc_controller_t *controller;
+  rng_t rng[num_rng_streams];
+  level_pregen_t *pregen;
+  int32_t depth;
+  level_store_t *levels;
+  /* Bytes of frozen floors to keep in memory; see level.h. */
+  size_t level_budget;
+  room_graph_t *room_graph;
   std::vector<monster_description> monster_descriptions;
   std::vector<object_description> object_descriptions;
 };
 
 void init_dungeon(dungeon *d);
+void size_dungeon(dungeon *d, int16_t x, int16_t y);
+void seed_dungeon(dungeon *d, uint64_t seed);
 void new_dungeon(dungeon *d);
+void pregen_level(dungeon *d);
 void delete_dungeon(dungeon *d);
+void init_dungeon_contents(dungeon *d);
+void delete_dungeon_contents(dungeon *d);
 int gen_dungeon(dungeon *d);
+void index_rooms(dungeon *d);
 void render_dungeon(dungeon *d);
+void gen_report(dungeon *d, FILE *f);
 int write_dungeon(dungeon *d, char *file);
+int write_dungeon_record(dungeon *d, pair_t pc, FILE *f);
+uint16_t count_up_stairs(dungeon *d);
+uint16_t count_down_stairs(dungeon *d);
 int read_dungeon(dungeon *d, char *file);
 int read_pgm(dungeon *d, char *pgm);
 void render_distance_map(dungeon *d);
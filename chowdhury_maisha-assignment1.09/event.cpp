@@ -1,16 +1,48 @@
 #include <cstdlib>
+#include <cstring>
 
 #include "event.h"
+#include "dungeon.h"
 #include "character.h"
 
-static uint32_t next_event_number(void)
+struct event_slab {
+  struct event_slab *next;
+  event events[];
+};
+
+/* Same growth policy as the heap's node slabs. */
+#define EVENT_MIN_SLAB 64
+
+static event *event_alloc(event_queue_t *q)
 {
-  static uint32_t sequence_number;
+  struct event_slab *slab;
+  uint32_t i, count;
+  event *e;
 
+  if (!q->free_events) {
+    count = q->capacity > EVENT_MIN_SLAB ? q->capacity : EVENT_MIN_SLAB;
+    slab = (struct event_slab *) malloc(sizeof (*slab) +
+                                        count * sizeof (slab->events[0]));
+    slab->next = q->slabs;
+    q->slabs = slab;
+    for (i = 0; i < count; i++) {
+      slab->events[i].next = q->free_events;
+      q->free_events = slab->events + i;
+    }
+    q->capacity += count;
+  }
+  e = q->free_events;
+  q->free_events = e->next;
+
+  return e;
+}
+
+static uint32_t next_event_number(event_queue_t *q)
+{
   /* We need to special case the first PC insert, because monsters go *
    * into the queue before the PC.  Pre-increment ensures that this   *
    * starts at 1, so we can use a zero there.                         */
-  return ++sequence_number;
+  return ++q->sequence;
 }
 
 int32_t compare_events(const void *event1, const void *event2)
@@ -28,11 +60,11 @@ event *new_event(dungeon *d, eventype_t t, void *v, uint32_t delay)
 {
   event *e;
 
-  e = (event *) malloc(sizeof (*e));
+  e = event_alloc(&d->events);
 
   e->type = t;
   e->time = d->time + delay;
-  e->sequence = next_event_number();
+  e->sequence = next_event_number(&d->events);
   switch (t) {
   case event_character_turn:
     e->c = (character *) v;
@@ -44,11 +76,13 @@ event *new_event(dungeon *d, eventype_t t, void *v, uint32_t delay)
 event *update_event(dungeon *d, event *e, uint32_t delay)
 {
   e->time = d->time + delay;
-  e->sequence = next_event_number();
+  e->sequence = next_event_number(&d->events);
 
   return e;
 }
 
+/* Deletes whatever the event refers to.  The event itself belongs to *
+ * the queue's pool, and goes back with it, or with event_free().      */
 void event_delete(void *v)
 {
   event *e = (event *) v;
@@ -58,6 +92,127 @@ void event_delete(void *v)
     character_delete(e->c);
     break;
   }
+}
+
+/* Deletes an event that has come out of the queue for good. */
+void event_free(event_queue_t *q, event *e)
+{
+  event_delete(e);
+  e->next = q->free_events;
+  q->free_events = e;
+}
+
+void event_queue_init(event_queue_t *q, uint32_t now)
+{
+  memset(q->head, 0, sizeof (q->head));
+  memset(q->tail, 0, sizeof (q->tail));
+  memset(q->occupied, 0, sizeof (q->occupied));
+  q->now = now;
+  q->size = 0;
+  q->sequence = 0;
+  heap_init(&q->overflow, compare_events, event_delete);
+  q->free_events = NULL;
+  q->slabs = NULL;
+  q->capacity = 0;
+}
+
+void event_queue_delete(event_queue_t *q)
+{
+  struct event_slab *slab;
+  event *e;
+  uint32_t i;
+
+  for (i = 0; i < EVENT_WHEEL_SLOTS; i++) {
+    for (e = q->head[i]; e; e = e->next) {
+      event_delete(e);
+    }
+  }
+  heap_delete(&q->overflow);
+  while ((slab = q->slabs)) {
+    q->slabs = slab->next;
+    free(slab);
+  }
+  event_queue_init(q, q->now);
+}
+
+/* Events have to be no earlier than the last one removed, and less *
+ * than a full turn of the wheel past it, to go in the wheel.       */
+void event_queue_insert(event_queue_t *q, event *e)
+{
+  uint32_t s;
+  event *p;
+
+  if (EVENT_QUEUE_HEAP                              ||
+      e->time < q->now                              ||
+      e->time - q->now >= EVENT_WHEEL_SLOTS) {
+    heap_insert(&q->overflow, e);
+    return;
+  }
+
+  s = e->time & (EVENT_WHEEL_SLOTS - 1);
+  e->next = NULL;
+  if (!q->head[s]) {
+    q->head[s] = q->tail[s] = e;
+    q->occupied[s / 64] |= 1ULL << (s % 64);
+  } else if (e->sequence > q->tail[s]->sequence) {
+    q->tail[s]->next = e;
+    q->tail[s] = e;
+  } else if (e->sequence < q->head[s]->sequence) {
+    /* The PC, which always goes first on a tie. */
+    e->next = q->head[s];
+    q->head[s] = e;
+  } else {
+    for (p = q->head[s]; p->next->sequence < e->sequence; p = p->next)
+      ;
+    e->next = p->next;
+    p->next = e;
+  }
+  q->size++;
+}
+
+/* The first slot in use at or after now is the earliest thing in the *
+ * wheel; the bits below now in its word are a full turn later.       */
+static uint32_t event_queue_next_slot(event_queue_t *q)
+{
+  uint32_t s, w;
+  uint64_t bits;
+
+  s = q->now & (EVENT_WHEEL_SLOTS - 1);
+  w = s / 64;
+  bits = q->occupied[w] & (~0ULL << (s % 64));
+  while (!bits) {
+    w = (w + 1) % EVENT_WHEEL_WORDS;
+    bits = q->occupied[w];
+  }
+
+  return w * 64 + __builtin_ctzll(bits);
+}
 
-  free(e);
+event *event_queue_remove_min(event_queue_t *q)
+{
+  event *e, *o;
+  uint32_t s;
+
+  e = NULL;
+  s = 0;
+  if (q->size) {
+    s = event_queue_next_slot(q);
+    e = q->head[s];
+  }
+  if ((o = (event *) heap_peek_min(&q->overflow)) &&
+      (!e || compare_events(o, e) < 0)) {
+    e = (event *) heap_remove_min(&q->overflow);
+  } else if (e) {
+    if (!(q->head[s] = e->next)) {
+      q->tail[s] = NULL;
+      q->occupied[s / 64] &= ~(1ULL << (s % 64));
+    }
+    q->size--;
+  }
+
+  if (e && e->time > q->now) {
+    q->now = e->time;
+  }
+
+  return e;
 }
@@ -3,7 +3,30 @@
 
 # include <stdint.h>
 
-# include "dungeon.h"
+# include "heap.h"
+
+/* Set to 1 to schedule everything with the Fibonacci heap, as before. */
+# ifndef EVENT_QUEUE_HEAP
+#  define EVENT_QUEUE_HEAP 0
+# endif
+
+/* Every turn is scheduled 1000 / speed ticks out, for some speed of at *
+ * least one, so nothing ever lands more than 1000 ticks in the future. *
+ * That makes a timing wheel a natural fit: one slot per tick, indexed  *
+ * by time modulo the number of slots, each holding the events due at   *
+ * that tick in sequence order, plus a bitmap of which slots are in use. *
+ * Since sequence numbers only ever go up, a new event almost always     *
+ * goes on the end of its slot, so scheduling is O(1), and finding the   *
+ * next event is a scan of a few words of bitmap.  Anything that doesn't *
+ * fit in the wheel (nothing, in practice) goes into a Fibonacci heap,    *
+ * and the two are merged on the way out, so that the order is exactly   *
+ * (time, sequence), same as it always was.                              */
+# define EVENT_WHEEL_SLOTS 1024
+# define EVENT_WHEEL_WORDS (EVENT_WHEEL_SLOTS / 64)
+
+class dungeon;
+class character;
+struct event_slab;
 
 typedef enum eventype {
   event_character_turn,
@@ -16,11 +39,31 @@ struct event {
   union {
     character *c;
   };
+  event *next;
 };
 
+typedef struct event_queue {
+  event *head[EVENT_WHEEL_SLOTS];
+  event *tail[EVENT_WHEEL_SLOTS];
+  uint64_t occupied[EVENT_WHEEL_WORDS];
+  uint32_t now;
+  uint32_t size;
+  uint32_t sequence;
+  heap_t overflow;
+  /* Events are pooled, like heap nodes, and live as long as the queue. */
+  event *free_events;
+  struct event_slab *slabs;
+  uint32_t capacity;
+} event_queue_t;
+
 int32_t compare_events(const void *event1, const void *event2);
 event *new_event(dungeon *d, eventype_t t, void *v, uint32_t delay);
 event *update_event(dungeon *d, event *e, uint32_t delay);
 void event_delete(void *e);
+void event_free(event_queue_t *q, event *e);
+void event_queue_init(event_queue_t *q, uint32_t now);
+void event_queue_delete(event_queue_t *q);
+void event_queue_insert(event_queue_t *q, event *e);
+event *event_queue_remove_min(event_queue_t *q);
 
 #endif
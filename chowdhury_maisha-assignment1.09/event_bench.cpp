@@ -0,0 +1,102 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+
+#include "dungeon.h"
+#include "event.h"
+#include "heap.h"
+
+/* Times the turn loop's scheduling alone, with the Fibonacci heap and *
+ * with the timing wheel, and checks that both run the monsters in     *
+ * exactly the same order.  Monsters are just events here; their speed *
+ * is looked up by index.                                              */
+
+#define BENCH_MONSTERS 10000
+#define BENCH_TURNS    2000000
+
+static dungeon d;
+
+static uint64_t run(uint32_t use_heap, event *ev, uint32_t *speed,
+                    uint32_t monsters, uint32_t turns, double *seconds)
+{
+  heap_t h;
+  event_queue_t *q;
+  event *e;
+  uint64_t order;
+  uint32_t i;
+
+  q = (event_queue_t *) malloc(sizeof (*q));
+  d.time = 0;
+  heap_init(&h, compare_events, NULL);
+  event_queue_init(q, d.time);
+
+  for (i = 0; i < monsters; i++) {
+    ev[i].type = event_character_turn;
+    ev[i].c = NULL;
+    update_event(&d, ev + i, 0);
+    if (use_heap) {
+      heap_insert(&h, ev + i);
+    } else {
+      event_queue_insert(q, ev + i);
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  for (order = 0, i = 0; i < turns; i++) {
+    if (use_heap) {
+      e = (event *) heap_remove_min(&h);
+    } else {
+      e = event_queue_remove_min(q);
+    }
+    d.time = e->time;
+    order = order * 31 + (e - ev);
+    update_event(&d, e, 1000 / speed[e - ev]);
+    if (use_heap) {
+      heap_insert(&h, e);
+    } else {
+      event_queue_insert(q, e);
+    }
+  }
+  *seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                           start).count();
+
+  heap_delete(&h);
+  /* The events aren't ours to delete. */
+  free(q);
+
+  return order;
+}
+
+int main(int argc, char *argv[])
+{
+  uint32_t monsters, turns, i;
+  uint32_t *speed;
+  event *ev;
+  double heap_time, wheel_time;
+  uint64_t heap_order, wheel_order;
+
+  monsters = argc > 1 ? atoi(argv[1]) : BENCH_MONSTERS;
+  turns = argc > 2 ? atoi(argv[2]) : BENCH_TURNS;
+
+  ev = (event *) calloc(monsters, sizeof (*ev));
+  speed = (uint32_t *) malloc(monsters * sizeof (*speed));
+  seed_dungeon(&d, 0);
+  speed[0] = PC_SPEED;
+  for (i = 1; i < monsters; i++) {
+    speed[i] = rand_range(d.rng + rng_level, NPC_MIN_SPEED, NPC_MAX_SPEED);
+  }
+
+  heap_order = run(1, ev, speed, monsters, turns, &heap_time);
+  wheel_order = run(0, ev, speed, monsters, turns, &wheel_time);
+
+  printf("%u monsters, %u turns\n", monsters, turns);
+  printf("Fibonacci heap: %.1f ns/turn\n", heap_time * 1e9 / turns);
+  printf("Timing wheel:   %.1f ns/turn\n", wheel_time * 1e9 / turns);
+  printf("Turn order %s.\n", heap_order == wheel_order ? "matches" : "DIFFERS");
+
+  free(ev);
+  free(speed);
+
+  return heap_order != wheel_order;
+}
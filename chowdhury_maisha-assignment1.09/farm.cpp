@@ -0,0 +1,250 @@
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "farm.h"
+#include "dungeon.h"
+#include "pc.h"
+#include "npc.h"
+#include "object.h"
+#include "level.h"
+#include "utils.h"
+
+typedef enum farm_outcome {
+  farm_won,
+  farm_died,
+  farm_out_of_turns,
+  num_farm_outcomes
+} farm_outcome_t;
+
+typedef struct farm_game {
+  farm_outcome_t outcome;
+  uint32_t pc_turns;
+  double seconds;
+  gen_stats_t gen;
+  /* How many of each monster description died, in the order of the *
+   * template's descriptions.                                         */
+  uint32_t *killed;
+} farm_game_t;
+
+typedef struct farm {
+  dungeon *templ;
+  const farm_config_t *config;
+  farm_game_t *games;
+  uint32_t num_descriptions;
+  pthread_mutex_t lock;
+  uint32_t next_game;
+} farm_t;
+
+static double farm_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Plays game i to the end, just as main() would headless.  Nothing in *
+ * a game touches anything outside of its own dungeon; every random    *
+ * draw comes from the dungeon's own d->rng[] streams, seeded from the *
+ * game's number, so games need no locking among themselves.           */
+static void farm_play(farm_t *f, uint32_t i)
+{
+  dungeon d;
+  farm_game_t *g;
+  uint32_t j;
+  double start;
+
+  g = f->games + i;
+  start = farm_clock();
+
+  seed_dungeon(&d, f->config->first_seed + i);
+  size_dungeon(&d, dungeon_x(f->templ), dungeon_y(f->templ));
+  d.max_monsters = f->templ->max_monsters;
+  d.max_objects = f->templ->max_objects;
+  d.level_budget = f->templ->level_budget;
+  d.controller = f->templ->controller;
+  d.monster_descriptions = f->templ->monster_descriptions;
+  d.object_descriptions = f->templ->object_descriptions;
+
+  init_dungeon(&d);
+  gen_dungeon(&d);
+  config_pc(&d);
+  gen_monsters(&d);
+  gen_objects(&d);
+  pc_observe_terrain(d.PC, &d);
+
+  while (pc_is_alive(&d) && dungeon_has_npcs(&d) && !d.quit &&
+         (!f->config->max_turns ||
+          d.stats.pc_turns < f->config->max_turns)) {
+    do_moves(&d);
+  }
+
+  g->outcome = (!pc_is_alive(&d) ? farm_died :
+                !dungeon_has_npcs(&d) ? farm_won : farm_out_of_turns);
+  g->pc_turns = d.stats.pc_turns;
+  g->gen = d.gen_stats;
+
+  if (pc_is_alive(&d)) {
+    character_delete(d.PC);
+  }
+  level_store_delete(&d);
+  delete_dungeon(&d);
+
+  for (j = 0; j < f->num_descriptions; j++) {
+    g->killed[j] = d.monster_descriptions[j].get_num_killed();
+  }
+  destroy_descriptions(&d);
+
+  g->seconds = farm_clock() - start;
+}
+
+static void *farm_worker(void *v)
+{
+  farm_t *f = (farm_t *) v;
+  uint32_t i;
+
+  for (;;) {
+    pthread_mutex_lock(&f->lock);
+    i = f->next_game++;
+    pthread_mutex_unlock(&f->lock);
+
+    if (i >= f->config->games) {
+      break;
+    }
+    farm_play(f, i);
+  }
+
+  return NULL;
+}
+
+static void farm_report(farm_t *f, FILE *o, double seconds)
+{
+  static const char *outcome_name[num_farm_outcomes] = {
+    "won",
+    "died",
+    "out of turns"
+  };
+  uint32_t outcomes[num_farm_outcomes];
+  uint64_t turns, killed;
+  uint32_t min_turns, max_turns;
+  double busy, min_seconds, max_seconds;
+  gen_stats_t gen;
+  uint32_t i, j;
+
+  memset(outcomes, 0, sizeof (outcomes));
+  turns = 0;
+  min_turns = UINT32_MAX;
+  max_turns = 0;
+  busy = max_seconds = 0;
+  min_seconds = 1e300;
+  memset(&gen, 0, sizeof (gen));
+  for (i = 0; i < f->config->games; i++) {
+    outcomes[f->games[i].outcome]++;
+    turns += f->games[i].pc_turns;
+    if (f->games[i].pc_turns < min_turns) {
+      min_turns = f->games[i].pc_turns;
+    }
+    if (f->games[i].pc_turns > max_turns) {
+      max_turns = f->games[i].pc_turns;
+    }
+    busy += f->games[i].seconds;
+    if (f->games[i].seconds < min_seconds) {
+      min_seconds = f->games[i].seconds;
+    }
+    if (f->games[i].seconds > max_seconds) {
+      max_seconds = f->games[i].seconds;
+    }
+    gen.levels += f->games[i].gen.levels;
+    gen.room_attempts += f->games[i].gen.room_attempts;
+    gen.room_restarts += f->games[i].gen.room_restarts;
+    gen.corridor_cells += f->games[i].gen.corridor_cells;
+    gen.ns += f->games[i].gen.ns;
+    if (f->games[i].gen.max_room_attempts > gen.max_room_attempts) {
+      gen.max_room_attempts = f->games[i].gen.max_room_attempts;
+    }
+    if (f->games[i].gen.max_ns > gen.max_ns) {
+      gen.max_ns = f->games[i].gen.max_ns;
+    }
+  }
+
+  fprintf(o, "%u games (seeds %u to %u) on %u threads in %.3f seconds: "
+          "%.1f games/second.\n", f->config->games, f->config->first_seed,
+          f->config->first_seed + f->config->games - 1, f->config->threads,
+          seconds, seconds > 0 ? f->config->games / seconds : 0.0);
+  for (i = 0; i < num_farm_outcomes; i++) {
+    fprintf(o, "  %-14s %8u  %5.1f%%\n", outcome_name[i], outcomes[i],
+            100.0 * outcomes[i] / f->config->games);
+  }
+  fprintf(o, "PC turns: %.1f per game (%u to %u), %.0f turns/second.\n",
+          (double) turns / f->config->games, min_turns, max_turns,
+          seconds > 0 ? turns / seconds : 0.0);
+  fprintf(o, "Wall time: %.3f ms per game (%.3f to %.3f), "
+          "%.2f games running at once on average.\n",
+          busy * 1000 / f->config->games, min_seconds * 1000,
+          max_seconds * 1000, seconds > 0 ? busy / seconds : 0.0);
+  if (gen.levels) {
+    fprintf(o, "Level generation: %.3f ms per level (worst %.3f), "
+            "%.1f room placement attempts per level (worst %u), "
+            "%u restarts, %.0f corridor cells searched per level.\n",
+            gen.ns / 1e6 / gen.levels, gen.max_ns / 1e6,
+            (double) gen.room_attempts / gen.levels, gen.max_room_attempts,
+            gen.room_restarts, (double) gen.corridor_cells / gen.levels);
+  }
+
+  fprintf(o, "Monsters killed:\n");
+  for (j = 0; j < f->num_descriptions; j++) {
+    for (killed = i = 0; i < f->config->games; i++) {
+      killed += f->games[i].killed[j];
+    }
+    if (killed) {
+      fprintf(o, "  %-30s %8llu  %7.3f per game\n",
+              f->templ->monster_descriptions[j].get_name().c_str(),
+              (unsigned long long) killed,
+              (double) killed / f->config->games);
+    }
+  }
+}
+
+int farm_run(dungeon *templ, const farm_config_t *config, FILE *o)
+{
+  farm_t f;
+  pthread_t *threads;
+  uint32_t *killed;
+  uint32_t i;
+  double start;
+
+  f.templ = templ;
+  f.config = config;
+  f.num_descriptions = templ->monster_descriptions.size();
+  f.games = (farm_game_t *) malloc(config->games * sizeof (*f.games));
+  killed = (uint32_t *) malloc((config->games * f.num_descriptions + 1) *
+                               sizeof (*killed));
+  for (i = 0; i < config->games; i++) {
+    f.games[i].killed = killed + i * f.num_descriptions;
+  }
+  pthread_mutex_init(&f.lock, NULL);
+  f.next_game = 0;
+  threads = (pthread_t *) malloc(config->threads * sizeof (*threads));
+
+  start = farm_clock();
+  for (i = 0; i < config->threads; i++) {
+    if (pthread_create(threads + i, NULL, farm_worker, &f)) {
+      fprintf(stderr, "Failed to start farm thread %u.\n", i);
+      exit(-1);
+    }
+  }
+  for (i = 0; i < config->threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  farm_report(&f, o, farm_clock() - start);
+
+  pthread_mutex_destroy(&f.lock);
+  free(threads);
+  free(killed);
+  free(f.games);
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+#ifndef FARM_H
+# define FARM_H
+
+# include <stdio.h>
+# include <stdint.h>
+
+class dungeon;
+
+/* Plays a batch of headless games, spread over a pool of threads, and *
+ * reports on how they went as a whole.  Game i is seeded with         *
+ * first_seed + i, so any one of them can be replayed on its own with  *
+ * --rand.                                                             */
+typedef struct farm_config {
+  uint32_t games;
+  uint32_t threads;
+  uint32_t first_seed;
+  uint32_t max_turns;
+} farm_config_t;
+
+/* Every game copies its monster and object descriptions, monster and  *
+ * object counts and PC controller from the template dungeon, which is *
+ * otherwise left alone.                                               */
+int farm_run(dungeon *templ, const farm_config_t *config, FILE *f);
+
+#endif
@@ -0,0 +1,105 @@
+#ifndef GRID_H
+# define GRID_H
+
+# include <stdio.h>
+# include <stdint.h>
+# include <stdlib.h>
+# include <string.h>
+
+/* Rows of run-time sized grids start on a multiple of this many cells. */
+# define GRID_ROW_ALIGN 64
+
+/* A rectangle of cells, stored a row at a time in one block, row y      *
+ * starting y * stride() cells in, so that g[y][x] works just as it does *
+ * on a two-dimensional array, and a flat index y * stride() + x means   *
+ * the same cell in every grid of the same dimensions, whatever it       *
+ * holds.  size() counts every cell, padding included.                   *
+ *                                                                       *
+ * Given dimensions at compile time, a grid is nothing but the array,    *
+ * every size is a constant, and resize() only checks that it's asked    *
+ * for the size it already is.  Otherwise (X and Y both zero), it's      *
+ * sized at run time, and each row is padded out to a multiple of        *
+ * GRID_ROW_ALIGN cells.  Either way, a new grid is all zeros.           */
+template <class T, int32_t X = 0, int32_t Y = 0>
+class grid {
+ private:
+  T cells[Y][X];
+ public:
+  grid() : cells() {}
+  grid(int32_t x, int32_t y) : cells() { resize(x, y); }
+  static constexpr int32_t width() { return X; }
+  static constexpr int32_t height() { return Y; }
+  static constexpr int32_t stride() { return X; }
+  static constexpr uint32_t size() { return X * Y; }
+  inline T *operator[](int32_t y) { return cells[y]; }
+  inline const T *operator[](int32_t y) const { return cells[y]; }
+  inline T *data() { return cells[0]; }
+  inline const T *data() const { return cells[0]; }
+  void resize(int32_t x, int32_t y)
+  {
+    if (x != X || y != Y) {
+      fprintf(stderr, "Grids of this build are %dx%d, not %dx%d.\n",
+              X, Y, x, y);
+      exit(-1);
+    }
+  }
+  void fill(T v)
+  {
+    uint32_t i;
+
+    for (i = 0; i < size(); i++) {
+      data()[i] = v;
+    }
+  }
+  void copy(const grid &g) { memcpy(cells, g.cells, sizeof (cells)); }
+};
+
+template <class T>
+class grid<T, 0, 0> {
+ private:
+  T *cells;
+  int32_t x, y, s;
+ public:
+  grid() : cells(0), x(0), y(0), s(0) {}
+  grid(int32_t x, int32_t y) : cells(0), x(0), y(0), s(0) { resize(x, y); }
+  grid(const grid &) = delete;
+  grid &operator=(const grid &) = delete;
+  ~grid() { free(cells); }
+  inline int32_t width() const { return x; }
+  inline int32_t height() const { return y; }
+  inline int32_t stride() const { return s; }
+  inline uint32_t size() const { return (uint32_t) s * y; }
+  inline T *operator[](int32_t row) { return cells + row * s; }
+  inline const T *operator[](int32_t row) const { return cells + row * s; }
+  inline T *data() { return cells; }
+  inline const T *data() const { return cells; }
+  void resize(int32_t new_x, int32_t new_y)
+  {
+    if (new_x == x && new_y == y) {
+      return;
+    }
+    free(cells);
+    x = new_x;
+    y = new_y;
+    s = (x + GRID_ROW_ALIGN - 1) / GRID_ROW_ALIGN * GRID_ROW_ALIGN;
+    if (!(cells = (T *) calloc(size(), sizeof (T)))) {
+      perror("calloc");
+      exit(-1);
+    }
+  }
+  void fill(T v)
+  {
+    uint32_t i;
+
+    for (i = 0; i < size(); i++) {
+      cells[i] = v;
+    }
+  }
+  void copy(const grid &g)
+  {
+    resize(g.x, g.y);
+    memcpy(cells, g.cells, size() * sizeof (T));
+  }
+};
+
+#endif
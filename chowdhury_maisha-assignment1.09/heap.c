@@ -15,6 +15,16 @@ struct heap_node {
   uint32_t mark;
 };
 
+struct heap_slab {
+  struct heap_slab *next;
+  heap_node_t nodes[];
+};
+
+/* Smallest slab we'll bother allocating.  After the first, each slab is *
+ * as big as all of the ones before it put together, so a heap that      *
+ * grows to n nodes makes O(lg n) allocations over its whole lifetime.   */
+#define HEAP_MIN_SLAB 64
+
 #define swap(a, b) ({    \
   typeof (a) _tmp = (a); \
   (a) = (b);             \
@@ -91,6 +101,44 @@ void print_heap_node_list(heap_node_t *n)
   printf("\n");
 }
 
+static void heap_grow(heap_t *h, uint32_t count)
+{
+  struct heap_slab *slab;
+  uint32_t i;
+
+  assert((slab = malloc(sizeof (*slab) + count * sizeof (slab->nodes[0]))));
+  slab->next = h->slabs;
+  h->slabs = slab;
+
+  for (i = 0; i < count; i++) {
+    slab->nodes[i].next = h->free_nodes;
+    h->free_nodes = slab->nodes + i;
+  }
+  h->capacity += count;
+}
+
+static heap_node_t *heap_node_alloc(heap_t *h)
+{
+  heap_node_t *n;
+
+  if (!h->free_nodes) {
+    heap_grow(h, h->capacity > HEAP_MIN_SLAB ? h->capacity : HEAP_MIN_SLAB);
+  }
+  n = h->free_nodes;
+  h->free_nodes = n->next;
+
+  n->parent = n->child = NULL;
+  n->degree = n->mark = 0;
+
+  return n;
+}
+
+static void heap_node_free(heap_t *h, heap_node_t *n)
+{
+  n->next = h->free_nodes;
+  h->free_nodes = n;
+}
+
 void heap_init(heap_t *h,
                int32_t (*compare)(const void *key, const void *with),
                void (*datum_delete)(void *))
@@ -99,8 +147,27 @@ void heap_init(heap_t *h,
   h->size = 0;
   h->compare = compare;
   h->datum_delete = datum_delete;
+  h->free_nodes = NULL;
+  h->slabs = NULL;
+  h->capacity = 0;
+}
+
+/* For callers that know roughly how big the heap will get, so that it *
+ * can all be allocated up front, in one piece.                        */
+void heap_init_with_capacity(heap_t *h,
+                             int32_t (*compare)(const void *key,
+                                                const void *with),
+                             void (*datum_delete)(void *),
+                             uint32_t capacity)
+{
+  heap_init(h, compare, datum_delete);
+  if (capacity) {
+    heap_grow(h, capacity);
+  }
 }
 
+/* Only needs to visit the nodes if there's data to delete; the nodes *
+ * themselves go back with their slabs.                               */
 void heap_node_delete(heap_t *h, heap_node_t *hn)
 {
   heap_node_t *next;
@@ -111,30 +178,35 @@ void heap_node_delete(heap_t *h, heap_node_t *hn)
       heap_node_delete(h, hn->child);
     } 
     next = hn->next;
-    if (h->datum_delete) {
-      h->datum_delete(hn->datum);
-    }
-    free(hn);
+    h->datum_delete(hn->datum);
     hn = next;
   }
 }
 
 void heap_delete(heap_t *h)
 {
-  if (h->min) {
+  struct heap_slab *slab;
+
+  if (h->min && h->datum_delete) {
     heap_node_delete(h, h->min);
   }
+  while ((slab = h->slabs)) {
+    h->slabs = slab->next;
+    free(slab);
+  }
   h->min = NULL;
   h->size = 0;
   h->compare = NULL;
   h->datum_delete = NULL;
+  h->free_nodes = NULL;
+  h->capacity = 0;
 }
 
 heap_node_t *heap_insert(heap_t *h, void *v)
 {
   heap_node_t *n;
 
-  assert((n = calloc(1, sizeof (*n))));
+  n = heap_node_alloc(h);
   n->datum = v;
 
   if (h->min) {
@@ -220,7 +292,7 @@ void *heap_remove_min(heap_t *h)
   if (h->min) {
     v = h->min->datum;
     if (h->size == 1) {
-      free(h->min);
+      heap_node_free(h, h->min);
       h->min = NULL;
     } else {
       if ((n = h->min->child)) {
@@ -234,7 +306,7 @@ void *heap_remove_min(heap_t *h)
       n = h->min;
       remove_heap_node_from_list(n);
       h->min = n->next;
-      free(n);
+      heap_node_free(h, n);
 
       heap_consolidate(h);
     }
@@ -247,6 +319,9 @@ void *heap_remove_min(heap_t *h)
 
 int heap_combine(heap_t *h, heap_t *h1, heap_t *h2)
 {
+  struct heap_slab **tail;
+  heap_node_t **free_tail;
+
   if (h1->compare != h2->compare ||
       h1->datum_delete != h2->datum_delete) {
     return 1;
@@ -255,6 +330,17 @@ int heap_combine(heap_t *h, heap_t *h1, heap_t *h2)
   h->compare = h1->compare;
   h->datum_delete = h1->datum_delete;
 
+  /* The nodes in h now live in the slabs of both. */
+  for (tail = &h1->slabs; *tail; tail = &(*tail)->next)
+    ;
+  *tail = h2->slabs;
+  h->slabs = h1->slabs;
+  for (free_tail = &h1->free_nodes; *free_tail; free_tail = &(*free_tail)->next)
+    ;
+  *free_tail = h2->free_nodes;
+  h->free_nodes = h1->free_nodes;
+  h->capacity = h1->capacity + h2->capacity;
+
   if (!h1->min) {
     h->min = h2->min;
     h->size = h2->size;
@@ -266,6 +352,7 @@ int heap_combine(heap_t *h, heap_t *h1, heap_t *h2)
               h1->min                                          :
               h2->min);
     splice_heap_node_lists(h1->min, h2->min);
+    h->size = h1->size + h2->size;
   }
 
   memset(h1, 0, sizeof (*h1));
@@ -9,18 +9,35 @@ extern "C" {
 
 struct heap_node;
 typedef struct heap_node heap_node_t;
+struct heap_slab;
 
+/* Nodes are carved out of slabs owned by the heap, rather than malloced *
+ * one at a time, and go onto a free list when they come out, to be      *
+ * reused by the next insert.  Slabs are only returned by heap_delete(), *
+ * all at once.                                                          */
 typedef struct heap {
   heap_node_t *min;
   uint32_t size;
   int32_t (*compare)(const void *key, const void *with);
   void (*datum_delete)(void *);
+  heap_node_t *free_nodes;
+  struct heap_slab *slabs;
+  uint32_t capacity;
 } heap_t;
 
 void heap_init(heap_t *h,
                int32_t (*compare)(const void *key, const void *with),
                void (*datum_delete)(void *));
+void heap_init_with_capacity(heap_t *h,
+                             int32_t (*compare)(const void *key,
+                                                const void *with),
+                             void (*datum_delete)(void *),
+                             uint32_t capacity);
 void heap_delete(heap_t *h);
+/* There's no bulk build.  Insertion is O(1) already, and a search *
+ * that would otherwise load every cell up front does better to    *
+ * queue cells only as they're first reached, as the bucket queue  *
+ * in path.cpp does.                                               */
 heap_node_t *heap_insert(heap_t *h, void *v);
 void *heap_peek_min(heap_t *h);
 void *heap_remove_min(heap_t *h);
@@ -12,6 +12,7 @@
 #include "object.h"
 #include "npc.h"
 #include "character.h"
+#include "autopilot.h"
 #include <iostream>
 #include <sstream>
 
@@ -28,9 +29,64 @@ typedef struct io_message {
 
 static io_message_t *io_head, *io_tail;
 
+/* With no terminal, there's nothing to draw and nobody to read the *
+ * messages.                                                        */
+static uint32_t io_headless;
+
+/* Multicolored monsters flicker.  Which color they show is nobody's *
+ * business but the display's, so it doesn't come out of the game's  *
+ * generators.                                                       */
+static rng_t io_rng;
+
+/* The screen shows DUNGEON_X by DUNGEON_Y cells of the level, starting *
+ * at io_view; on a level no bigger than that, the whole thing.  The    *
+ * view moves when whatever it follows--the PC, or a cursor--gets       *
+ * within PC_VISUAL_RANGE of an edge of it that isn't the level's own,  *
+ * and then centers on it.                                              */
+static pair_t io_view;
+
+#define io_row(y) ((y) - io_view[dim_y] + 1)
+#define io_col(x) ((x) - io_view[dim_x])
+#define io_view_end(dim, size) (io_view[dim] + (size))
+
+static int16_t io_view_axis(int16_t origin, int16_t at, int16_t size,
+                            int16_t level)
+{
+  if (at < origin + PC_VISUAL_RANGE ||
+      at >= origin + size - PC_VISUAL_RANGE) {
+    origin = at - size / 2;
+  }
+  if (origin > level - size) {
+    origin = level - size;
+  }
+
+  return origin < 0 ? 0 : origin;
+}
+
+/* Returns nonzero if the view moved. */
+static uint32_t io_set_view(dungeon *d, pair_t at)
+{
+  pair_t old;
+
+  old[dim_x] = io_view[dim_x];
+  old[dim_y] = io_view[dim_y];
+  io_view[dim_x] = io_view_axis(io_view[dim_x], at[dim_x],
+                                DUNGEON_X, dungeon_x(d));
+  io_view[dim_y] = io_view_axis(io_view[dim_y], at[dim_y],
+                                DUNGEON_Y, dungeon_y(d));
+
+  return old[dim_x] != io_view[dim_x] || old[dim_y] != io_view[dim_y];
+}
+
+void io_init_headless(void)
+{
+  io_headless = 1;
+}
+
 void io_init_terminal(void)
 {
   initscr();
+  rng_seed(&io_rng, 0);
   raw();
   noecho();
   curs_set(0);
@@ -62,6 +118,10 @@ void io_queue_message(const char *format, ...)
   io_message_t *tmp;
   va_list ap;
 
+  if (io_headless) {
+    return;
+  }
+
   if (!(tmp = (io_message_t *) malloc(sizeof (*tmp)))) {
     perror("malloc");
     exit(1);
@@ -105,16 +165,18 @@ static void io_print_message_queue(uint32_t y, uint32_t x)
 
 void io_display_tunnel(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
+  path_ensure(d, path_tunnel);
+  io_set_view(d, d->PC->position);
   clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = io_view[dim_y]; y < io_view_end(dim_y, DUNGEON_Y); y++) {
+    for (x = io_view[dim_x]; x < io_view_end(dim_x, DUNGEON_X); x++) {
       if (charxy(x, y) == d->PC) {
-        mvaddch(y + 1, x, charxy(x, y)->symbol);
+        mvaddch(io_row(y), io_col(x), charxy(x, y)->symbol);
       } else if (hardnessxy(x, y) == 255) {
-        mvaddch(y + 1, x, '*');
+        mvaddch(io_row(y), io_col(x), '*');
       } else {
-        mvaddch(y + 1, x, '0' + (d->pc_tunnel[y][x] % 10));
+        mvaddch(io_row(y), io_col(x), '0' + (d->pc_tunnel.at(x, y) % 10));
       }
     }
   }
@@ -123,16 +185,18 @@ void io_display_tunnel(dungeon *d)
 
 void io_display_distance(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
+  path_ensure(d, path_walk);
+  io_set_view(d, d->PC->position);
   clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = io_view[dim_y]; y < io_view_end(dim_y, DUNGEON_Y); y++) {
+    for (x = io_view[dim_x]; x < io_view_end(dim_x, DUNGEON_X); x++) {
       if (charxy(x, y)) {
-        mvaddch(y + 1, x, charxy(x, y)->symbol);
+        mvaddch(io_row(y), io_col(x), charxy(x, y)->symbol);
       } else if (hardnessxy(x, y) != 0) {
-        mvaddch(y + 1, x, ' ');
+        mvaddch(io_row(y), io_col(x), ' ');
       } else {
-        mvaddch(y + 1, x, '0' + (d->pc_distance[y][x] % 10));
+        mvaddch(io_row(y), io_col(x), '0' + (d->pc_distance.at(x, y) % 10));
       }
     }
   }
@@ -144,19 +208,21 @@ static char hardness_to_char[] =
 
 void io_display_hardness(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
+  io_set_view(d, d->PC->position);
   clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = io_view[dim_y]; y < io_view_end(dim_y, DUNGEON_Y); y++) {
+    for (x = io_view[dim_x]; x < io_view_end(dim_x, DUNGEON_X); x++) {
       /* Maximum hardness is 255.  We have 62 values to display it, but *
        * we only want one zero value, so we need to cover [1,255] with  *
        * 61 values, which gives us a divisor of 254 / 61 = 4.164.       *
        * Generally, we want to avoid floating point math, but this is   *
        * not gameplay, so we'll make an exception here to get maximal   *
        * hardness display resolution.                                   */
-      mvaddch(y + 1, x, (d->hardness[y][x]                             ?
-                         hardness_to_char[1 + (int) ((d->hardness[y][x] /
-                                                      4.2))] : ' '));
+      mvaddch(io_row(y), io_col(x),
+              (d->hardness[y][x]                             ?
+               hardness_to_char[1 + (int) ((d->hardness[y][x] /
+                                            4.2))] : ' '));
     }
   }
   refresh();
@@ -186,9 +252,9 @@ static void io_redisplay_visible_monsters(dungeon *d)
          pos[dim_x] <= PC_VISUAL_RANGE;
          pos[dim_x]++) {
       if ((d->PC->position[dim_y] + pos[dim_y] < 0) ||
-          (d->PC->position[dim_y] + pos[dim_y] >= DUNGEON_Y) ||
+          (d->PC->position[dim_y] + pos[dim_y] >= dungeon_y(d)) ||
           (d->PC->position[dim_x] + pos[dim_x] < 0) ||
-          (d->PC->position[dim_x] + pos[dim_x] >= DUNGEON_X)) {
+          (d->PC->position[dim_x] + pos[dim_x] >= dungeon_x(d))) {
         continue;
       }
       if ((illuminated = is_illuminated(d->PC,
@@ -202,12 +268,12 @@ static void io_redisplay_visible_monsters(dungeon *d)
                   d->character_map[d->PC->position[dim_y] + pos[dim_y]]
                                   [d->PC->position[dim_x] +
                                    pos[dim_x]]->position, 1, 0)) {
-        attron(COLOR_PAIR((color = d->character_map[d->PC->position[dim_y] +
-                                                    pos[dim_y]]
-                                                   [d->PC->position[dim_x] +
-                                                    pos[dim_x]]->get_color())));
-        mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                d->PC->position[dim_x] + pos[dim_x],
+        color = (d->character_map[d->PC->position[dim_y] + pos[dim_y]]
+                                 [d->PC->position[dim_x] + pos[dim_x]]->
+                 get_color(&io_rng));
+        attron(COLOR_PAIR(color));
+        mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                io_col(d->PC->position[dim_x] + pos[dim_x]),
                 character_get_symbol(d->character_map[d->PC->position[dim_y] +
                                                       pos[dim_y]]
                                                      [d->PC->position[dim_x] +
@@ -224,8 +290,8 @@ static void io_redisplay_visible_monsters(dungeon *d)
         attron(COLOR_PAIR(d->objmap[d->PC->position[dim_y] + pos[dim_y]]
                                    [d->PC->position[dim_x] +
                                     pos[dim_x]]->get_color()));
-        mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                d->PC->position[dim_x] + pos[dim_x],
+        mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                io_col(d->PC->position[dim_x] + pos[dim_x]),
                 d->objmap[d->PC->position[dim_y] + pos[dim_y]]
                          [d->PC->position[dim_x] + pos[dim_x]]->get_symbol());
         attroff(COLOR_PAIR(d->objmap[d->PC->position[dim_y] + pos[dim_y]]
@@ -239,35 +305,35 @@ static void io_redisplay_visible_monsters(dungeon *d)
         case ter_wall:
         case ter_wall_immutable:
         case ter_unknown:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], ' ');
+          mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                  io_col(d->PC->position[dim_x] + pos[dim_x]), ' ');
           break;
         case ter_floor:
         case ter_floor_room:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '.');
+          mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                  io_col(d->PC->position[dim_x] + pos[dim_x]), '.');
           break;
         case ter_floor_hall:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '#');
+          mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                  io_col(d->PC->position[dim_x] + pos[dim_x]), '#');
           break;
         case ter_debug:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '*');
+          mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                  io_col(d->PC->position[dim_x] + pos[dim_x]), '*');
           break;
         case ter_stairs_up:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '<');
+          mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                  io_col(d->PC->position[dim_x] + pos[dim_x]), '<');
           break;
         case ter_stairs_down:
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '>');
+          mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                  io_col(d->PC->position[dim_x] + pos[dim_x]), '>');
           break;
         default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-          mvaddch(d->PC->position[dim_y] + pos[dim_y] + 1,
-                  d->PC->position[dim_x] + pos[dim_x], '0');
+          mvaddch(io_row(d->PC->position[dim_y] + pos[dim_y]),
+                  io_col(d->PC->position[dim_x] + pos[dim_x]), '0');
         }
       }
       attroff(A_BOLD);
@@ -281,23 +347,27 @@ static int compare_monster_distance(const void *v1, const void *v2)
 {
   const character *const *c1 = (const character *const *) v1;
   const character *const *c2 = (const character *const *) v2;
+  uint32_t d1, d2;
+
+  d1 = thedungeon->pc_distance.at((*c1)->position[dim_x],
+                                  (*c1)->position[dim_y]);
+  d2 = thedungeon->pc_distance.at((*c2)->position[dim_x],
+                                  (*c2)->position[dim_y]);
 
-  return (thedungeon->pc_distance[(*c1)->position[dim_y]]
-                                 [(*c1)->position[dim_x]] -
-          thedungeon->pc_distance[(*c2)->position[dim_y]]
-                                 [(*c2)->position[dim_x]]);
+  return (d1 > d2) - (d1 < d2);
 }
 
 static character *io_nearest_visible_monster(dungeon *d)
 {
   character **c, *n;
-  uint32_t x, y, count, i;
+  int32_t x, y;
+  uint32_t count, i;
 
   c = (character **) malloc(d->num_monsters * sizeof (*c));
 
   /* Get a linear list of monsters */
-  for (count = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
+  for (count = 0, y = 1; y < dungeon_y(d) - 1; y++) {
+    for (x = 1; x < dungeon_x(d) - 1; x++) {
       if (d->character_map[y][x] && d->character_map[y][x] != d->PC) {
         c[count++] = d->character_map[y][x];
       }
@@ -306,6 +376,7 @@ static character *io_nearest_visible_monster(dungeon *d)
 
   /* Sort it by distance from PC */
   thedungeon = d;
+  path_ensure(d, path_walk);
   qsort(c, count, sizeof (*c), compare_monster_distance);
 
   for (n = NULL, i = 0; i < count; i++) {
@@ -328,11 +399,18 @@ void io_display(dungeon *d)
   character *c;
   int32_t visible_monsters;
 
+  if (io_headless) {
+    return;
+  }
+
+  io_set_view(d, d->PC->position);
   clear();
-  for (visible_monsters = -1, pos[dim_y] = 0;
-       pos[dim_y] < DUNGEON_Y;
+  for (visible_monsters = -1, pos[dim_y] = io_view[dim_y];
+       pos[dim_y] < io_view_end(dim_y, DUNGEON_Y);
        pos[dim_y]++) {
-    for (pos[dim_x] = 0; pos[dim_x] < DUNGEON_X; pos[dim_x]++) {
+    for (pos[dim_x] = io_view[dim_x];
+         pos[dim_x] < io_view_end(dim_x, DUNGEON_X);
+         pos[dim_x]++) {
       if ((illuminated = is_illuminated(d->PC,
                                         pos[dim_y],
                                         pos[dim_x]))) {
@@ -345,9 +423,9 @@ void io_display(dungeon *d)
                   character_get_pos(d->character_map[pos[dim_y]]
                                                     [pos[dim_x]]), 1, 0)) {
         visible_monsters++;
-        attron(COLOR_PAIR((color = d->character_map[pos[dim_y]]
-                                                   [pos[dim_x]]->get_color())));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
+        color = d->character_map[pos[dim_y]][pos[dim_x]]->get_color(&io_rng);
+        attron(COLOR_PAIR(color));
+        mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]),
                 character_get_symbol(d->character_map[pos[dim_y]]
                                                      [pos[dim_x]]));
         attroff(COLOR_PAIR(color));
@@ -358,7 +436,7 @@ void io_display(dungeon *d)
                   can_see(d, character_get_pos(d->PC), pos, 1, 0))) {
         attron(COLOR_PAIR(d->objmap[pos[dim_y]]
                                    [pos[dim_x]]->get_color()));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
+        mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]),
                 d->objmap[pos[dim_y]]
                          [pos[dim_x]]->get_symbol());
         attroff(COLOR_PAIR(d->objmap[pos[dim_y]]
@@ -370,28 +448,28 @@ void io_display(dungeon *d)
         case ter_wall:
         case ter_wall_immutable:
         case ter_unknown:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], ' ');
+          mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]), ' ');
           break;
         case ter_floor:
         case ter_floor_room:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '.');
+          mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]), '.');
           break;
         case ter_floor_hall:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '#');
+          mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]), '#');
           break;
         case ter_debug:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '*');
+          mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]), '*');
           break;
         case ter_stairs_up:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '<');
+          mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]), '<');
           break;
         case ter_stairs_down:
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '>');
+          mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]), '>');
           break;
         default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-          mvaddch(pos[dim_y] + 1, pos[dim_x], '0');
+          mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]), '0');
         }
       }
       if (illuminated) {
@@ -434,24 +512,28 @@ static void io_redisplay_non_terrain(dungeon *d, pair_t cursor)
   uint32_t color;
   uint32_t illuminated;
 
-  for (pos[dim_y] = 0; pos[dim_y] < DUNGEON_Y; pos[dim_y]++) {
-    for (pos[dim_x] = 0; pos[dim_x] < DUNGEON_X; pos[dim_x]++) {
+  for (pos[dim_y] = io_view[dim_y];
+       pos[dim_y] < io_view_end(dim_y, DUNGEON_Y);
+       pos[dim_y]++) {
+    for (pos[dim_x] = io_view[dim_x];
+         pos[dim_x] < io_view_end(dim_x, DUNGEON_X);
+         pos[dim_x]++) {
       if ((illuminated = is_illuminated(d->PC,
                                         pos[dim_y],
                                         pos[dim_x]))) {
         attron(A_BOLD);
       }
       if (cursor[dim_y] == pos[dim_y] && cursor[dim_x] == pos[dim_x]) {
-        mvaddch(pos[dim_y] + 1, pos[dim_x], '*');
+        mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]), '*');
       } else if (d->character_map[pos[dim_y]][pos[dim_x]]) {
-        attron(COLOR_PAIR((color = d->character_map[pos[dim_y]]
-                                                   [pos[dim_x]]->get_color())));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
+        color = d->character_map[pos[dim_y]][pos[dim_x]]->get_color(&io_rng);
+        attron(COLOR_PAIR(color));
+        mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]),
                 character_get_symbol(d->character_map[pos[dim_y]][pos[dim_x]]));
         attroff(COLOR_PAIR(color));
       } else if (d->objmap[pos[dim_y]][pos[dim_x]]) {
         attron(COLOR_PAIR(d->objmap[pos[dim_y]][pos[dim_x]]->get_color()));
-        mvaddch(pos[dim_y] + 1, pos[dim_x],
+        mvaddch(io_row(pos[dim_y]), io_col(pos[dim_x]),
                 d->objmap[pos[dim_y]][pos[dim_x]]->get_symbol());
         attroff(COLOR_PAIR(d->objmap[pos[dim_y]][pos[dim_x]]->get_color()));
       }
@@ -462,49 +544,52 @@ static void io_redisplay_non_terrain(dungeon *d, pair_t cursor)
   refresh();
 }
 
-void io_display_no_fog(dungeon *d)
+/* Everything, fog or no fog, in the view as it stands. */
+static void io_draw_no_fog(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
   uint32_t color;
   character *c;
 
   clear();
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = io_view[dim_y]; y < io_view_end(dim_y, DUNGEON_Y); y++) {
+    for (x = io_view[dim_x]; x < io_view_end(dim_x, DUNGEON_X); x++) {
       if (d->character_map[y][x]) {
-        attron(COLOR_PAIR((color = d->character_map[y][x]->get_color())));
-        mvaddch(y + 1, x, character_get_symbol(d->character_map[y][x]));
+        color = d->character_map[y][x]->get_color(&io_rng);
+        attron(COLOR_PAIR(color));
+        mvaddch(io_row(y), io_col(x),
+                character_get_symbol(d->character_map[y][x]));
         attroff(COLOR_PAIR(color));
       } else if (d->objmap[y][x]) {
         attron(COLOR_PAIR(d->objmap[y][x]->get_color()));
-        mvaddch(y + 1, x, d->objmap[y][x]->get_symbol());
+        mvaddch(io_row(y), io_col(x), d->objmap[y][x]->get_symbol());
         attroff(COLOR_PAIR(d->objmap[y][x]->get_color()));
       } else {
         switch (mapxy(x, y)) {
         case ter_wall:
         case ter_wall_immutable:
-          mvaddch(y + 1, x, ' ');
+          mvaddch(io_row(y), io_col(x), ' ');
           break;
         case ter_floor:
         case ter_floor_room:
-          mvaddch(y + 1, x, '.');
+          mvaddch(io_row(y), io_col(x), '.');
           break;
         case ter_floor_hall:
-          mvaddch(y + 1, x, '#');
+          mvaddch(io_row(y), io_col(x), '#');
           break;
         case ter_debug:
-          mvaddch(y + 1, x, '*');
+          mvaddch(io_row(y), io_col(x), '*');
           break;
         case ter_stairs_up:
-          mvaddch(y + 1, x, '<');
+          mvaddch(io_row(y), io_col(x), '<');
           break;
         case ter_stairs_down:
-          mvaddch(y + 1, x, '>');
+          mvaddch(io_row(y), io_col(x), '>');
           break;
         default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-          mvaddch(y + 1, x, '0');
+          mvaddch(io_row(y), io_col(x), '0');
         }
       }
     }
@@ -537,6 +622,12 @@ void io_display_no_fog(dungeon *d)
   refresh();
 }
 
+void io_display_no_fog(dungeon *d)
+{
+  io_set_view(d, d->PC->position);
+  io_draw_no_fog(d);
+}
+
 void io_display_monster_list(dungeon *d)
 {
   mvprintw(11, 33, " HP:    XXXXX ");
@@ -546,8 +637,20 @@ void io_display_monster_list(dungeon *d)
   getch();
 }
 
+/* Brings a cursor that's wandered off toward the edge of the view *
+ * back into it, redrawing everything, prompt included.            */
+static void io_track_cursor(dungeon *d, pair_t cursor, const char *prompt)
+{
+  if (io_set_view(d, cursor)) {
+    io_draw_no_fog(d);
+    mvprintw(0, 0, "%s", prompt);
+  }
+}
+
 uint32_t io_teleport_pc(dungeon *d)
 {
+  static const char *prompt =
+    "Choose a location.  'g' or '.' to teleport to; 'r' for random.";
   pair_t dest;
   int c;
   fd_set readfs;
@@ -556,13 +659,12 @@ uint32_t io_teleport_pc(dungeon *d)
   pc_reset_visibility(d->PC);
   io_display_no_fog(d);
 
-  mvprintw(0, 0,
-           "Choose a location.  'g' or '.' to teleport to; 'r' for random.");
+  mvprintw(0, 0, "%s", prompt);
 
   dest[dim_y] = d->PC->position[dim_y];
   dest[dim_x] = d->PC->position[dim_x];
 
-  mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
+  mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), '*');
   refresh();
 
   do {
@@ -582,28 +684,28 @@ uint32_t io_teleport_pc(dungeon *d)
     case ter_wall:
     case ter_wall_immutable:
     case ter_unknown:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], ' ');
+      mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), ' ');
       break;
     case ter_floor:
     case ter_floor_room:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '.');
+      mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), '.');
       break;
     case ter_floor_hall:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '#');
+      mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), '#');
       break;
     case ter_debug:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
+      mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), '*');
       break;
     case ter_stairs_up:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '<');
+      mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), '<');
       break;
     case ter_stairs_down:
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '>');
+      mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), '>');
       break;
     default:
  /* Use zero as an error symbol, since it stands out somewhat, and it's *
   * not otherwise used.                                                 */
-      mvaddch(dest[dim_y] + 1, dest[dim_x], '0');
+      mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), '0');
     }
     switch ((c = getch())) {
     case '7':
@@ -629,38 +731,38 @@ uint32_t io_teleport_pc(dungeon *d)
       if (dest[dim_y] != 1) {
         dest[dim_y]--;
       }
-      if (dest[dim_x] != DUNGEON_X - 2) {
+      if (dest[dim_x] != dungeon_x(d) - 2) {
         dest[dim_x]++;
       }
       break;
     case '6':
     case 'l':
     case KEY_RIGHT:
-      if (dest[dim_x] != DUNGEON_X - 2) {
+      if (dest[dim_x] != dungeon_x(d) - 2) {
         dest[dim_x]++;
       }
       break;
     case '3':
     case 'n':
     case KEY_NPAGE:
-      if (dest[dim_y] != DUNGEON_Y - 2) {
+      if (dest[dim_y] != dungeon_y(d) - 2) {
         dest[dim_y]++;
       }
-      if (dest[dim_x] != DUNGEON_X - 2) {
+      if (dest[dim_x] != dungeon_x(d) - 2) {
         dest[dim_x]++;
       }
       break;
     case '2':
     case 'j':
     case KEY_DOWN:
-      if (dest[dim_y] != DUNGEON_Y - 2) {
+      if (dest[dim_y] != dungeon_y(d) - 2) {
         dest[dim_y]++;
       }
       break;
     case '1':
     case 'b':
     case KEY_END:
-      if (dest[dim_y] != DUNGEON_Y - 2) {
+      if (dest[dim_y] != dungeon_y(d) - 2) {
         dest[dim_y]++;
       }
       if (dest[dim_x] != 1) {
@@ -675,12 +777,13 @@ uint32_t io_teleport_pc(dungeon *d)
       }
       break;
     }
+    io_track_cursor(d, dest, prompt);
   } while (c != 'g' && c != '.' && c != 'r');
 
   if (c == 'r') {
     do {
-      dest[dim_x] = rand_range(1, DUNGEON_X - 2);
-      dest[dim_y] = rand_range(1, DUNGEON_Y - 2);
+      dest[dim_x] = rand_range(d->rng + rng_pc, 1, dungeon_x(d) - 2);
+      dest[dim_y] = rand_range(d->rng + rng_pc, 1, dungeon_y(d) - 2);
     } while (charpair(dest) || mappair(dest) < ter_floor);
   }
 
@@ -695,8 +798,7 @@ uint32_t io_teleport_pc(dungeon *d)
   }
 
   pc_observe_terrain(d->PC, d);
-  dijkstra(d);
-  dijkstra_tunnel(d);
+  path_note_pc_moved(d);
 
   io_display(d);
 
@@ -841,13 +943,14 @@ static void io_list_monsters_display(dungeon *d,
 static void io_list_monsters(dungeon *d)
 {
   character **c;
-  uint32_t x, y, count;
+  int32_t x, y;
+  uint32_t count;
 
   c = (character **) malloc(d->num_monsters * sizeof (*c));
 
   /* Get a linear list of monsters */
-  for (count = 0, y = 1; y < DUNGEON_Y - 1; y++) {
-    for (x = 1; x < DUNGEON_X - 1; x++) {
+  for (count = 0, y = 1; y < dungeon_y(d) - 1; y++) {
+    for (x = 1; x < dungeon_x(d) - 1; x++) {
       if (d->character_map[y][x] && d->character_map[y][x] != d->PC &&
           can_see(d, character_get_pos(d->PC),
                   character_get_pos(d->character_map[y][x]), 1, 0)) {
@@ -858,6 +961,7 @@ static void io_list_monsters(dungeon *d)
 
   /* Sort it by distance from PC */
   thedungeon = d;
+  path_ensure(d, path_walk);
   qsort(c, count, sizeof (*c), compare_monster_distance);
 
   /* Display it */
@@ -875,7 +979,12 @@ void io_handle_input(dungeon *d)
   fd_set readfs;
   struct timeval tv;
   uint32_t fog_off = 0;
-  pair_t tmp = { DUNGEON_X, DUNGEON_Y };
+  pair_t tmp = { -1, -1 };
+
+  if (d->controller) {
+    d->controller->take_turn(d);
+    return;
+  }
 
   do {
     do{
@@ -1055,6 +1164,8 @@ void io_handle_input(dungeon *d)
 //new from here
 void monster_selection(dungeon *d)
 {
+  static const char *prompt = "Select a monster. Press 't' to show their "
+    "description, press 'ESC' to abort.";
   pair_t dest;
   int c;
   fd_set readfs;
@@ -1063,12 +1174,12 @@ void monster_selection(dungeon *d)
   pc_reset_visibility(d->PC);
   io_display_no_fog(d);
 
-  mvprintw(0, 0, "Select a monster. Press 't' to show their description, press 'ESC' to abort.");
+  mvprintw(0, 0, "%s", prompt);
 
   dest[dim_y] = d->PC->position[dim_y];
   dest[dim_x] = d->PC->position[dim_x];
 
-  mvaddch(dest[dim_y] + 1, dest[dim_x], '*');
+  mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), '*');
   refresh();
 
   bool done = false;
@@ -1096,7 +1207,7 @@ void monster_selection(dungeon *d)
       case ter_stairs_down: display_char = '>'; break;
       default: display_char = '0'; break;
     }
-    mvaddch(dest[dim_y] + 1, dest[dim_x], display_char);
+    mvaddch(io_row(dest[dim_y]), io_col(dest[dim_x]), display_char);
 
     c = getch();
 
@@ -1120,15 +1231,16 @@ void monster_selection(dungeon *d)
       int new_y = dest[dim_y] + dy;
       int new_x = dest[dim_x] + dx;
 
-      if (new_y > 0 && new_y < DUNGEON_Y - 1) dest[dim_y] = new_y;
-      if (new_x > 0 && new_x < DUNGEON_X - 1) dest[dim_x] = new_x;
+      if (new_y > 0 && new_y < dungeon_y(d) - 1) dest[dim_y] = new_y;
+      if (new_x > 0 && new_x < dungeon_x(d) - 1) dest[dim_x] = new_x;
+      io_track_cursor(d, dest, prompt);
     }
   }
 
   if (c == 'r') {
     do {
-      dest[dim_x] = rand_range(1, DUNGEON_X - 2);
-      dest[dim_y] = rand_range(1, DUNGEON_Y - 2);
+      dest[dim_x] = rand_range(d->rng + rng_pc, 1, dungeon_x(d) - 2);
+      dest[dim_y] = rand_range(d->rng + rng_pc, 1, dungeon_y(d) - 2);
     } while (charpair(dest) || mappair(dest) < ter_floor);
   }
 
@@ -1151,8 +1263,6 @@ void monster_selection(dungeon *d)
     } while (!(dummy = getchar()));
   }
   pc_observe_terrain(d->PC, d);
-  dijkstra(d);
-  dijkstra_tunnel(d);
   io_display(d);
 }
 
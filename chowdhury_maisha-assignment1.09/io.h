@@ -5,6 +5,7 @@
 
 class dungeon;
 
+void io_init_headless(void);
 void io_init_terminal(void);
 void io_reset_terminal(void);
 void io_display(dungeon *d);
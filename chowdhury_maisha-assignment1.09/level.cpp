@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "level.h"
+#include "dungeon.h"
+#include "pc.h"
+#include "npc.h"
+#include "object.h"
+#include "event.h"
+#include "path.h"
+#include "roomgraph.h"
+
+/* Ends the monsters in a frozen level, and the objects in a pile. */
+#define FROZEN_END UINT32_MAX
+
+/* A frozen floor is, in order: the map, hardness, the rooms (count     *
+ * first), the PC's known terrain and position, the level's monster and *
+ * object counts, a frozen_npc_t for every living monster in the order  *
+ * their turns come up, and then a frozen_pile_t for every occupied     *
+ * cell, each followed by its objects, top first, as a description      *
+ * index and whatever object::freeze() wrote.  It never outlives the    *
+ * process that wrote it, so everything is in native byte order.        */
+typedef struct frozen_npc {
+  uint32_t description;
+  pair_t position;
+  pair_t pc_last_known_position;
+  int32_t speed;
+  uint32_t hp;
+  npc_characteristics_t characteristics;
+  uint32_t have_seen_pc;
+  uint32_t sequence_number;
+  uint32_t kills[num_kill_types];
+  /* Ticks from the time the PC left until the monster's next turn. */
+  uint32_t delay;
+} frozen_npc_t;
+
+typedef struct frozen_pile {
+  pair_t position;
+  uint32_t count;
+} frozen_pile_t;
+
+/* One for each depth that has ever been frozen.  data is set while the *
+ * floor is frozen in memory, on_disk while it's frozen in the scratch  *
+ * file, and neither while the PC is on it.  A floor keeps its place in *
+ * the scratch file, and reuses it if it fits the next time it's        *
+ * evicted.                                                             */
+typedef struct frozen_level {
+  int32_t depth;
+  uint32_t last_visit;
+  char *data;
+  size_t size;
+  uint32_t on_disk;
+  long offset;
+  size_t space;
+} frozen_level_t;
+
+struct level_store {
+  frozen_level_t *levels;
+  uint32_t num_levels;
+  uint32_t max_levels;
+  uint32_t visits;
+  size_t in_memory;
+  FILE *disk;
+  long disk_end;
+  uint32_t frozen;
+  uint32_t thawed;
+  uint32_t evicted;
+  uint32_t read_back;
+  uint64_t bytes;
+  uint64_t ns;
+  uint64_t max_ns;
+};
+
+static inline uint64_t level_clock(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void level_read(FILE *f, void *v, size_t size)
+{
+  if (fread(v, size, 1, f) != 1) {
+    fprintf(stderr, "Frozen level is truncated.\n");
+    exit(-1);
+  }
+}
+
+/* Grids go out whole, row padding and all; every level of a dungeon *
+ * is the same size, so they come back into grids shaped the same.   */
+template <class T, int32_t X, int32_t Y>
+static void level_write_grid(FILE *f, const grid<T, X, Y> &g)
+{
+  fwrite(g.data(), sizeof (T), g.size(), f);
+}
+
+template <class T, int32_t X, int32_t Y>
+static void level_read_grid(FILE *f, grid<T, X, Y> &g)
+{
+  level_read(f, g.data(), g.size() * sizeof (T));
+}
+
+static frozen_level_t *level_find(level_store_t *s, int32_t depth)
+{
+  uint32_t i;
+
+  for (i = 0; i < s->num_levels; i++) {
+    if (s->levels[i].depth == depth) {
+      return s->levels + i;
+    }
+  }
+
+  return NULL;
+}
+
+static frozen_level_t *level_add(level_store_t *s, int32_t depth)
+{
+  frozen_level_t *l;
+
+  if (s->num_levels == s->max_levels) {
+    s->max_levels = s->max_levels ? s->max_levels * 2 : 8;
+    s->levels = (frozen_level_t *) realloc(s->levels, (s->max_levels *
+                                                       sizeof (*l)));
+  }
+  l = s->levels + s->num_levels++;
+  memset(l, 0, sizeof (*l));
+  l->depth = depth;
+
+  return l;
+}
+
+/* Writes out the level the PC is on and lets go of its monsters and    *
+ * objects.  Their descriptions go on counting them, so uniques and     *
+ * artifacts left behind on a floor don't turn up again somewhere else. *
+ * Monsters that have died but not yet come off the queue are deleted   *
+ * just as they would have been there.                                  */
+static void level_freeze(dungeon *d, FILE *f)
+{
+  frozen_npc_t fn;
+  frozen_pile_t pile;
+  uint32_t index, end;
+  event *e;
+  npc *n;
+  object *o;
+  pair_t p;
+
+  level_write_grid(f, d->map);
+  level_write_grid(f, d->hardness);
+  fwrite(&d->num_rooms, sizeof (d->num_rooms), 1, f);
+  fwrite(d->rooms, sizeof (*d->rooms), d->num_rooms, f);
+  level_write_grid(f, d->PC->known_terrain);
+  fwrite(d->PC->position, sizeof (d->PC->position), 1, f);
+  fwrite(&d->num_monsters, sizeof (d->num_monsters), 1, f);
+  fwrite(&d->num_objects, sizeof (d->num_objects), 1, f);
+
+  while ((e = event_queue_remove_min(&d->events))) {
+    n = (npc *) e->c;
+    if (n->alive) {
+      memset(&fn, 0, sizeof (fn));
+      fn.description = &n->md - &d->monster_descriptions[0];
+      fn.position[dim_y] = n->position[dim_y];
+      fn.position[dim_x] = n->position[dim_x];
+      fn.pc_last_known_position[dim_y] = n->pc_last_known_position[dim_y];
+      fn.pc_last_known_position[dim_x] = n->pc_last_known_position[dim_x];
+      fn.speed = n->speed;
+      fn.hp = n->hp;
+      fn.characteristics = n->characteristics;
+      fn.have_seen_pc = n->have_seen_pc;
+      fn.sequence_number = n->sequence_number;
+      memcpy(fn.kills, n->kills, sizeof (fn.kills));
+      fn.delay = e->time - d->time;
+      fwrite(&fn, sizeof (fn), 1, f);
+      /* Balances the destroy() in ~npc(). */
+      n->md.birth();
+    }
+    event_free(&d->events, e);
+  }
+  memset(&fn, 0, sizeof (fn));
+  fn.description = FROZEN_END;
+  fwrite(&fn, sizeof (fn), 1, f);
+
+  for (p[dim_y] = 0; p[dim_y] < dungeon_y(d); p[dim_y]++) {
+    for (p[dim_x] = 0; p[dim_x] < dungeon_x(d); p[dim_x]++) {
+      if (!objpair(p)) {
+        continue;
+      }
+      pile.position[dim_y] = p[dim_y];
+      pile.position[dim_x] = p[dim_x];
+      for (pile.count = 0, o = objpair(p); o; o = o->get_next()) {
+        pile.count++;
+      }
+      fwrite(&pile, sizeof (pile), 1, f);
+      for (o = objpair(p); o; o = o->get_next()) {
+        index = &o->get_od() - &d->object_descriptions[0];
+        fwrite(&index, sizeof (index), 1, f);
+        o->freeze(f);
+        /* Balances the destroy() in ~object(). */
+        o->get_od().generate();
+      }
+    }
+  }
+  memset(&pile, 0, sizeof (pile));
+  fwrite(&pile, sizeof (pile), 1, f);
+
+  destroy_objects(d);
+
+  end = FROZEN_END;
+  fwrite(&end, sizeof (end), 1, f);
+}
+
+/* The reverse of level_freeze(), into a dungeon with no level in it, *
+ * as init_dungeon_contents() leaves it.                              */
+static void level_thaw(dungeon *d, FILE *f)
+{
+  frozen_npc_t fn;
+  frozen_pile_t pile;
+  uint32_t index, end, i;
+  npc *n;
+  object *o, *below;
+
+  level_read_grid(f, d->map);
+  level_read_grid(f, d->hardness);
+  level_read(f, &d->num_rooms, sizeof (d->num_rooms));
+  d->rooms = (room_t *) malloc(d->num_rooms * sizeof (*d->rooms));
+  level_read(f, d->rooms, d->num_rooms * sizeof (*d->rooms));
+  /* The room index and graph come from nothing but the terrain and *
+   * the rooms.                                                      */
+  index_rooms(d);
+  room_graph_build(d);
+  level_read_grid(f, d->PC->known_terrain);
+  level_read(f, d->PC->position, sizeof (d->PC->position));
+  level_read(f, &d->num_monsters, sizeof (d->num_monsters));
+  level_read(f, &d->num_objects, sizeof (d->num_objects));
+
+  /* Turns come back in the order they were frozen, so the new queue *
+   * breaks ties among them the same way the old one would have.     */
+  for (;;) {
+    level_read(f, &fn, sizeof (fn));
+    if (fn.description == FROZEN_END) {
+      break;
+    }
+    n = new npc(d->monster_descriptions[fn.description], fn.position);
+    n->pc_last_known_position[dim_y] = fn.pc_last_known_position[dim_y];
+    n->pc_last_known_position[dim_x] = fn.pc_last_known_position[dim_x];
+    n->speed = fn.speed;
+    n->hp = fn.hp;
+    n->characteristics = fn.characteristics;
+    n->have_seen_pc = fn.have_seen_pc;
+    n->sequence_number = fn.sequence_number;
+    memcpy(n->kills, fn.kills, sizeof (n->kills));
+    charpair(n->position) = n;
+    event_queue_insert(&d->events,
+                       new_event(d, event_character_turn, n, fn.delay));
+  }
+
+  for (;;) {
+    level_read(f, &pile, sizeof (pile));
+    if (!pile.count) {
+      break;
+    }
+    for (below = NULL, i = 0; i < pile.count; i++) {
+      level_read(f, &index, sizeof (index));
+      o = new object(d->object_descriptions[index], pile.position, NULL, f);
+      if (below) {
+        below->set_next(o);
+      } else {
+        objpair(pile.position) = o;
+      }
+      below = o;
+    }
+  }
+
+  level_read(f, &end, sizeof (end));
+  if (end != FROZEN_END) {
+    fprintf(stderr, "Frozen level is corrupt.\n");
+    exit(-1);
+  }
+
+  charpair(d->PC->position) = d->PC;
+  pc_reset_visibility(d->PC);
+  pc_observe_terrain(d->PC, d);
+  path_invalidate(d);
+  d->is_new = 1;
+}
+
+/* Moves the frozen floors visited longest ago out to the scratch file *
+ * until the rest fit in the budget.  Without a scratch file, they all *
+ * just stay in memory.                                                */
+static void level_evict(level_store_t *s, size_t budget)
+{
+  frozen_level_t *l, *oldest;
+  uint32_t i;
+
+  while (s->in_memory > budget) {
+    for (oldest = NULL, i = 0; i < s->num_levels; i++) {
+      l = s->levels + i;
+      if (l->data && (!oldest || l->last_visit < oldest->last_visit)) {
+        oldest = l;
+      }
+    }
+
+    if (!s->disk && !(s->disk = tmpfile())) {
+      perror("tmpfile");
+      return;
+    }
+    if (oldest->space < oldest->size) {
+      oldest->offset = s->disk_end;
+      oldest->space = oldest->size;
+      s->disk_end += oldest->size;
+    }
+    if (fseek(s->disk, oldest->offset, SEEK_SET) ||
+        fwrite(oldest->data, oldest->size, 1, s->disk) != 1) {
+      perror("Evicting frozen level");
+      exit(-1);
+    }
+
+    free(oldest->data);
+    oldest->data = NULL;
+    oldest->on_disk = 1;
+    s->in_memory -= oldest->size;
+    s->evicted++;
+  }
+}
+
+/* Takes the PC from the level it's on to the one at depth, which it  *
+ * finds as it was left if it has been there before, and otherwise as *
+ * new_dungeon() makes it.                                            */
+void level_change(dungeon *d, int32_t depth)
+{
+  level_store_t *s;
+  frozen_level_t *l;
+  uint64_t start;
+  FILE *f;
+
+  if (!(s = d->levels)) {
+    s = d->levels = (level_store_t *) calloc(1, sizeof (*s));
+  }
+
+  if (!(l = level_find(s, d->depth))) {
+    l = level_add(s, d->depth);
+  }
+  if (!(f = open_memstream(&l->data, &l->size))) {
+    perror("open_memstream");
+    exit(-1);
+  }
+  level_freeze(d, f);
+  fclose(f);
+  l->last_visit = ++s->visits;
+  s->in_memory += l->size;
+  s->frozen++;
+  s->bytes += l->size;
+  level_evict(s, d->level_budget);
+
+  d->depth = depth;
+  if (!(l = level_find(s, depth)) || (!l->data && !l->on_disk)) {
+    new_dungeon(d);
+    return;
+  }
+
+  start = level_clock();
+  delete_dungeon_contents(d);
+  init_dungeon_contents(d);
+  if (l->data) {
+    if (!(f = fmemopen(l->data, l->size, "r"))) {
+      perror("fmemopen");
+      exit(-1);
+    }
+    level_thaw(d, f);
+    fclose(f);
+    free(l->data);
+    l->data = NULL;
+    s->in_memory -= l->size;
+  } else {
+    if (fseek(s->disk, l->offset, SEEK_SET)) {
+      perror("Reading back frozen level");
+      exit(-1);
+    }
+    level_thaw(d, s->disk);
+    l->on_disk = 0;
+    s->read_back++;
+  }
+  s->thawed++;
+
+  start = level_clock() - start;
+  s->ns += start;
+  if (start > s->max_ns) {
+    s->max_ns = start;
+  }
+}
+
+void level_report(dungeon *d, FILE *f)
+{
+  level_store_t *s;
+
+  if (!(s = d->levels) || !s->frozen) {
+    return;
+  }
+
+  fprintf(f, "Floors: %u frozen (%.1f KB each), %u thawed in %.3f ms "
+          "(worst %.3f ms); %u evicted to disk, %u read back.\n",
+          s->frozen, s->bytes / 1024.0 / s->frozen, s->thawed,
+          s->ns / 1e6, s->max_ns / 1e6, s->evicted, s->read_back);
+}
+
+void level_store_delete(dungeon *d)
+{
+  level_store_t *s;
+  uint32_t i;
+
+  if (!(s = d->levels)) {
+    return;
+  }
+
+  for (i = 0; i < s->num_levels; i++) {
+    free(s->levels[i].data);
+  }
+  free(s->levels);
+  if (s->disk) {
+    fclose(s->disk);
+  }
+  free(s);
+  d->levels = NULL;
+}
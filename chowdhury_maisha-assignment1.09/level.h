@@ -0,0 +1,25 @@
+#ifndef LEVEL_H
+# define LEVEL_H
+
+# include <stdio.h>
+# include <stdint.h>
+
+class dungeon;
+
+/* Floors the PC has left stay as they were, keyed by depth: down is  *
+ * one deeper, up is one shallower, and the first level is depth 0.   *
+ * Leaving a floor freezes it--terrain, rooms, what the PC has seen,  *
+ * where the PC stood, and every monster and object still on it--into *
+ * a flat buffer, and the floor's monsters and objects are let go.    *
+ * Coming back thaws the buffer in place of generating a new level.   *
+ *                                                                    *
+ * Frozen floors are kept in memory up to a budget of bytes; past     *
+ * that, the ones visited longest ago are evicted to a scratch file,  *
+ * which the system removes when the game ends.                       */
+# define LEVEL_MEMORY_BUDGET (1024 * 1024)
+
+void level_change(dungeon *d, int32_t depth);
+void level_report(dungeon *d, FILE *f);
+void level_store_delete(dungeon *d);
+
+#endif
@@ -3,6 +3,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <time.h>
 
 #include "dungeon.h"
 #include "heap.h"
@@ -15,6 +16,7 @@
 #include "event.h"
 #include "io.h"
 #include "npc.h"
+#include "level.h"
 
 void do_combat(dungeon *d, character *atk, character *def)
 {
@@ -60,10 +62,13 @@ void do_combat(dungeon *d, character *atk, character *def)
     if (def != d->PC) {
       d->num_monsters--;
     } else {
-      if ((part = rand() % (sizeof (organs) / sizeof (organs[0]))) < 26) {
+      if ((part = rng_below(d->rng + rng_combat,
+                            sizeof (organs) / sizeof (organs[0]))) < 26) {
         io_queue_message("As %s%s eats your %s,", is_unique(atk) ? "" : "the ",
-                         atk->name, organs[rand() % (sizeof (organs) /
-                                                     sizeof (organs[0]))]);
+                         atk->name,
+                         organs[rng_below(d->rng + rng_combat,
+                                          (sizeof (organs) /
+                                           sizeof (organs[0])))]);
         io_queue_message("   ...you wonder if there is an afterlife.");
         /* Queue an empty message, otherwise the game will not pause for *
          * player to see above.                                          */
@@ -133,11 +138,69 @@ void move_character(dungeon *d, character *c, pair_t next)
   }
 }
 
+static inline uint64_t move_clock(dungeon *d)
+{
+  struct timespec ts;
+
+  if (!d->stats.enabled) {
+    return 0;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Charges the time since the last phase ended to phase p. */
+static inline uint64_t move_phase(dungeon *d, move_phase_t p, uint64_t since)
+{
+  uint64_t now;
+
+  if (!d->stats.enabled) {
+    return 0;
+  }
+  now = move_clock(d);
+  d->stats.ns[p] += now - since;
+
+  return now;
+}
+
+void move_report(dungeon *d, FILE *f, double seconds)
+{
+  static const char *phase_name[num_move_phases] = {
+    "scheduling",
+    "monster AI",
+    "monster moves",
+    "display",
+    "PC turns"
+  };
+  uint64_t total;
+  uint32_t i;
+
+  fprintf(f, "%llu PC turns, %llu events in %.3f seconds: "
+          "%.0f turns/second, %.0f events/second.\n",
+          (unsigned long long) d->stats.pc_turns,
+          (unsigned long long) d->stats.events, seconds,
+          seconds > 0 ? d->stats.pc_turns / seconds : 0.0,
+          seconds > 0 ? d->stats.events / seconds : 0.0);
+
+  for (total = i = 0; i < num_move_phases; i++) {
+    total += d->stats.ns[i];
+  }
+  for (i = 0; i < num_move_phases; i++) {
+    fprintf(f, "  %-14s %10.3f ms  %5.1f%%\n", phase_name[i],
+            d->stats.ns[i] / 1e6,
+            total ? 100.0 * d->stats.ns[i] / total : 0.0);
+  }
+}
+
 void do_moves(dungeon *d)
 {
   pair_t next;
   character *c;
   event *e;
+  uint64_t t;
+
+  t = move_clock(d);
 
   /* Remove the PC when it is PC turn.  Replace on next call.  This allows *
    * use to completely uninit the heap when generating a new level without *
@@ -145,9 +208,9 @@ void do_moves(dungeon *d)
 
   if (pc_is_alive(d)) {
     /* The PC always goes first one a tie, so we don't use new_event().  *
-     * We generate one manually so that we can set the PC sequence       *
-     * number to zero.                                                   */
-    e = (event *) malloc(sizeof (*e));
+     * The PC has its own event, which lives in the dungeon and is just  *
+     * rescheduled each time, with the PC sequence number set to zero.   */
+    e = &d->pc_event;
     e->type = event_character_turn;
     /* Hack: New dungeons are marked.  Unmark and ensure PC goes at d->time, *
      * otherwise, monsters get a turn before the PC.                         */
@@ -159,12 +222,14 @@ void do_moves(dungeon *d)
     }
     e->sequence = 0;
     e->c = d->PC;
-    heap_insert(&d->events, e);
+    event_queue_insert(&d->events, e);
   }
 
   while (pc_is_alive(d) &&
-         (e = (event *) heap_remove_min(&d->events)) &&
+         (e = event_queue_remove_min(&d->events)) &&
          ((e->type != event_character_turn) || (e->c != d->PC))) {
+    t = move_phase(d, phase_schedule, t);
+    d->stats.events++;
     d->time = e->time;
     if (e->type == event_character_turn) {
       c = e->c;
@@ -174,27 +239,31 @@ void do_moves(dungeon *d)
         d->character_map[c->position[dim_y]][c->position[dim_x]] = NULL;
       }
       if (c != d->PC) {
-        event_delete(e);
+        event_free(&d->events, e);
       }
       continue;
     }
 
     npc_next_pos(d, (npc *) c, next);
+    t = move_phase(d, phase_npc_think, t);
     move_character(d, (npc *) c, next);
+    t = move_phase(d, phase_npc_move, t);
 
-    heap_insert(&d->events, update_event(d, e, 1000 / c->speed));
+    event_queue_insert(&d->events, update_event(d, e, 1000 / c->speed));
   }
+  t = move_phase(d, phase_schedule, t);
 
   io_display(d);
+  t = move_phase(d, phase_display, t);
   if (pc_is_alive(d) && e->c == d->PC) {
     c = e->c;
     d->time = e->time;
-    /* Kind of kludgey, but because the PC is never in the queue when   *
-     * we are outside of this function, the PC event has to get deleted *
-     * and recreated every time we leave and re-enter this function.    */
-    e->c = NULL;
-    event_delete(e);
+    /* The PC is never in the queue when we are outside of this function; *
+     * its event gets put back in the next time we come in.               */
     io_handle_input(d);
+    move_phase(d, phase_pc, t);
+    d->stats.events++;
+    d->stats.pc_turns++;
   }
 }
 
@@ -202,11 +271,13 @@ void dir_nearest_wall(dungeon *d, character *c, pair_t dir)
 {
   dir[dim_x] = dir[dim_y] = 0;
 
-  if (c->position[dim_x] != 1 && c->position[dim_x] != DUNGEON_X - 2) {
-    dir[dim_x] = (c->position[dim_x] > DUNGEON_X - c->position[dim_x] ? 1 : -1);
+  if (c->position[dim_x] != 1 && c->position[dim_x] != dungeon_x(d) - 2) {
+    dir[dim_x] = (c->position[dim_x] > dungeon_x(d) - c->position[dim_x] ?
+                  1 : -1);
   }
-  if (c->position[dim_y] != 1 && c->position[dim_y] != DUNGEON_Y - 2) {
-    dir[dim_y] = (c->position[dim_y] > DUNGEON_Y - c->position[dim_y] ? 1 : -1);
+  if (c->position[dim_y] != 1 && c->position[dim_y] != dungeon_y(d) - 2) {
+    dir[dim_y] = (c->position[dim_y] > dungeon_y(d) - c->position[dim_y] ?
+                  1 : -1);
   }
 }
 
@@ -242,13 +313,12 @@ uint32_t in_corner(dungeon *d, character *c)
 
 static void new_dungeon_level(dungeon *d, uint32_t dir)
 {
-  /* Eventually up and down will be independantly meaningful. *
-   * For now, simply generate a new dungeon.                  */
-
   switch (dir) {
   case '<':
+    level_change(d, d->depth - 1);
+    break;
   case '>':
-    new_dungeon(d);
+    level_change(d, d->depth + 1);
     break;
   default:
     break;
@@ -325,14 +395,14 @@ uint32_t move_pc(dungeon *d, uint32_t dir)
 
   if ((dir != '>') && (dir != '<') && (mappair(next) >= ter_floor)) {
     move_character(d, d->PC, next);
-    dijkstra(d);
-    dijkstra_tunnel(d);
+    path_note_pc_moved(d);
     d->PC->take_from_ground(d);//new
 
     return 0;
   } else if (mappair(next) < ter_floor) {
-    io_queue_message(wallmsg[rand() % (sizeof (wallmsg) /
-                                       sizeof (wallmsg[0]))]);
+    io_queue_message(wallmsg[rng_below(d->rng + rng_pc,
+                                       (sizeof (wallmsg) /
+                                        sizeof (wallmsg[0])))]);
     io_display(d);
   }
 
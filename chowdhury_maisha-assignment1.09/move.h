@@ -1,6 +1,7 @@
 #ifndef MOVE_H
 # define MOVE_H
 
+# include <stdio.h>
 # include <stdint.h>
 
 # include "dims.h"
@@ -8,6 +9,24 @@
 class character;
 class dungeon;
 
+/* Where do_moves() spends its time, for batch runs.  Only collected  *
+ * if enabled, since it means reading the clock a few times per turn. */
+typedef enum move_phase {
+  phase_schedule,
+  phase_npc_think,
+  phase_npc_move,
+  phase_display,
+  phase_pc,
+  num_move_phases
+} move_phase_t;
+
+typedef struct move_stats {
+  uint32_t enabled;
+  uint64_t pc_turns;
+  uint64_t events;
+  uint64_t ns[num_move_phases];
+} move_stats_t;
+
 void next_move(dungeon *d,
                character *c,
                pair_t goal_pos,
@@ -18,5 +37,6 @@ uint32_t in_corner(dungeon *d, character *c);
 uint32_t against_wall(dungeon *d, character *c);
 uint32_t move_pc(dungeon *d, uint32_t dir);
 void move_character(dungeon *d, character *c, pair_t next);
+void move_report(dungeon *d, FILE *f, double seconds);
 
 #endif
@@ -14,9 +14,12 @@ static uint32_t max_monster_cells(dungeon *d)
 {
   uint32_t i;
   uint32_t sum;
+  uint32_t pc_room;
 
+  /* Every room but the PC's; which one that is, is a single lookup. */
+  pc_room = roompair(d->PC->position);
   for (i = sum = 0; i < d->num_rooms; i++) {
-    if (!pc_in_room(d, i)) {
+    if (i + 1 != pc_room) {
       sum += d->rooms[i].size[dim_y] * d->rooms[i].size[dim_x];
     }
   }
@@ -51,7 +54,7 @@ void npc_next_pos_rand_tunnel(dungeon *d, npc *c, pair_t next)
   do {
     n[dim_y] = next[dim_y];
     n[dim_x] = next[dim_x];
-    r.i = rand();
+    r.i = rng_next(d->rng + rng_npc);
     if (r.a[0] > 85 /* 255 / 3 */) {
       if (r.a[0] & 1) {
         n[dim_y]--;
@@ -73,15 +76,15 @@ void npc_next_pos_rand_tunnel(dungeon *d, npc *c, pair_t next)
       hardnesspair(n) = 0;
       mappair(n) = ter_floor_hall;
 
-      /* Update distance maps because map has changed. */
-      dijkstra(d);
-      dijkstra_tunnel(d);
+      /* Distance maps are out of date because map has changed. */
+      path_note_terrain_change(d, n);
     }
 
     next[dim_x] = n[dim_x];
     next[dim_y] = n[dim_y];
   } else {
     hardnesspair(n) -= 85;
+    path_note_terrain_change(d, n);
   }
 }
 
@@ -96,7 +99,7 @@ void npc_next_pos_rand(dungeon *d, npc *c, pair_t next)
   do {
     n[dim_y] = next[dim_y];
     n[dim_x] = next[dim_x];
-    r.i = rand();
+    r.i = rng_next(d->rng + rng_npc);
     if (r.a[0] > 85 /* 255 / 3 */) {
       if (r.a[0] & 1) {
         n[dim_y]--;
@@ -128,7 +131,7 @@ void npc_next_pos_rand_pass(dungeon *d, character *c, pair_t next)
   do {
     n[dim_y] = next[dim_y];
     n[dim_x] = next[dim_x];
-    r.i = rand();
+    r.i = rng_next(d->rng + rng_npc);
     if (r.a[0] > 85 /* 255 / 3 */) {
       if (r.a[0] & 1) {
         n[dim_y]--;
@@ -199,138 +202,93 @@ void npc_next_pos_line_of_sight_tunnel(dungeon *d, npc *c, pair_t next)
       hardnesspair(dir) = 0;
       mappair(dir) = ter_floor_hall;
 
-      /* Update distance maps because map has changed. */
-      dijkstra(d);
-      dijkstra_tunnel(d);
+      /* Distance maps are out of date because map has changed. */
+      path_note_terrain_change(d, dir);
     }
 
     next[dim_x] = dir[dim_x];
     next[dim_y] = dir[dim_y];
   } else {
     hardnesspair(dir) -= 85;
+    path_note_terrain_change(d, dir);
   }
 }
 
+static void npc_next_pos_route(dungeon *d, npc *c, pair_t next);
+
 void npc_next_pos_gradient(dungeon *d, npc *c, pair_t next)
 {
-  /* Handles both tunneling and non-tunneling versions */
+  /* Handles both tunneling and non-tunneling versions.  The path code *
+   * has already worked out the best step out of every cell.           */
   pair_t min_next;
-  uint16_t min_cost;
+  uint32_t dir;
+
+  /* Except on levels big enough to have a room graph, where keeping *
+   * whole maps up to date every time the PC moves costs far more    *
+   * than routing each monster there a leg at a time.                */
+  if (d->room_graph) {
+    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+    npc_next_pos_route(d, c, next);
+    return;
+  }
+
   if (c->characteristics & NPC_TUNNEL) {
-    min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x]] +
-                (d->hardness[next[dim_y] - 1][next[dim_x]] / 85));
-    min_next[dim_x] = next[dim_x];
-    min_next[dim_y] = next[dim_y] - 1;
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x]    ] +
-         (d->hardness[next[dim_y] + 1][next[dim_x]] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x]] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x]] / 85));
-      min_next[dim_x] = next[dim_x];
-      min_next[dim_y] = next[dim_y] + 1;
-    }
-    if ((d->pc_tunnel[next[dim_y]    ][next[dim_x] + 1] +
-         (d->hardness[next[dim_y]    ][next[dim_x] + 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y]][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y]][next[dim_x] + 1] / 85));
-      min_next[dim_x] = next[dim_x] + 1;
-      min_next[dim_y] = next[dim_y];
-    }
-    if ((d->pc_tunnel[next[dim_y]    ][next[dim_x] - 1] +
-         (d->hardness[next[dim_y]    ][next[dim_x] - 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y]][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y]][next[dim_x] - 1] / 85));
-      min_next[dim_x] = next[dim_x] - 1;
-      min_next[dim_y] = next[dim_y];
-    }
-    if ((d->pc_tunnel[next[dim_y] - 1][next[dim_x] + 1] +
-         (d->hardness[next[dim_y] - 1][next[dim_x] + 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y] - 1][next[dim_x] + 1] / 85));
-      min_next[dim_x] = next[dim_x] + 1;
-      min_next[dim_y] = next[dim_y] - 1;
-    }
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x] + 1] +
-         (d->hardness[next[dim_y] + 1][next[dim_x] + 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x] + 1] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x] + 1] / 85));
-      min_next[dim_x] = next[dim_x] + 1;
-      min_next[dim_y] = next[dim_y] + 1;
-    }
-    if ((d->pc_tunnel[next[dim_y] - 1][next[dim_x] - 1] +
-         (d->hardness[next[dim_y] - 1][next[dim_x] - 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] - 1][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y] - 1][next[dim_x] - 1] / 85));
-      min_next[dim_x] = next[dim_x] - 1;
-      min_next[dim_y] = next[dim_y] - 1;
-    }
-    if ((d->pc_tunnel[next[dim_y] + 1][next[dim_x] - 1] +
-         (d->hardness[next[dim_y] + 1][next[dim_x] - 1] / 85)) < min_cost) {
-      min_cost = (d->pc_tunnel[next[dim_y] + 1][next[dim_x] - 1] +
-                  (d->hardness[next[dim_y] + 1][next[dim_x] - 1] / 85));
-      min_next[dim_x] = next[dim_x] - 1;
-      min_next[dim_y] = next[dim_y] + 1;
-    }
+    path_ensure(d, path_tunnel);
+    dir = path_tunnel_dir(d, next);
+    min_next[dim_x] = next[dim_x] + path_step[dir][dim_x];
+    min_next[dim_y] = next[dim_y] + path_step[dir][dim_y];
     if (hardnesspair(min_next) <= 85) {
       if (hardnesspair(min_next)) {
         hardnesspair(min_next) = 0;
         mappair(min_next) = ter_floor_hall;
 
-        /* Update distance maps because map has changed. */
-        dijkstra(d);
-        dijkstra_tunnel(d);
+        /* Distance maps are out of date because map has changed. */
+        path_note_terrain_change(d, min_next);
       }
 
       next[dim_x] = min_next[dim_x];
       next[dim_y] = min_next[dim_y];
     } else {
       hardnesspair(min_next) -= 85;
+      path_note_terrain_change(d, min_next);
     }
   } else {
-    /* Make monsters prefer cardinal directions */
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x]    ] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]--;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x]    ] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]++;
-      return;
-    }
-    if (d->pc_distance[next[dim_y]    ][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_x]++;
-      return;
-    }
-    if (d->pc_distance[next[dim_y]    ][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_x]--;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]--;
-      next[dim_x]++;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x] + 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]++;
-      next[dim_x]++;
-      return;
-    }
-    if (d->pc_distance[next[dim_y] - 1][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]--;
-      next[dim_x]--;
-      return;
+    path_ensure(d, path_walk);
+    dir = path_walk_dir(d, next);
+    next[dim_x] += path_step[dir][dim_x];
+    next[dim_y] += path_step[dir][dim_y];
+  }
+}
+
+/* Smart monsters that have lost sight of the PC head for wherever they *
+ * last saw it, by an actual route rather than in a straight line.  If  *
+ * there's no way there, they go back to the straight line.             */
+static void npc_next_pos_route(dungeon *d, npc *c, pair_t next)
+{
+  pair_t step;
+
+  if (!path_route_step(d, &c->route, c->position, c->pc_last_known_position,
+                       !!(c->characteristics & NPC_TUNNEL), step)) {
+    if (c->characteristics & NPC_TUNNEL) {
+      npc_next_pos_line_of_sight_tunnel(d, c, next);
+    } else {
+      npc_next_pos_line_of_sight(d, c, next);
     }
-    if (d->pc_distance[next[dim_y] + 1][next[dim_x] - 1] <
-        d->pc_distance[next[dim_y]][next[dim_x]]) {
-      next[dim_y]++;
-      next[dim_x]--;
-      return;
+  } else if (hardnesspair(step) <= 85) {
+    if (hardnesspair(step)) {
+      hardnesspair(step) = 0;
+      mappair(step) = ter_floor_hall;
+
+      /* Distance maps are out of date because map has changed. */
+      path_note_terrain_change(d, step);
     }
+
+    next[dim_x] = step[dim_x];
+    next[dim_y] = step[dim_y];
+  } else {
+    hardnesspair(step) -= 85;
+    path_note_terrain_change(d, step);
   }
 }
 
@@ -355,7 +313,7 @@ static void npc_next_pos_01(dungeon *d, npc *c, pair_t next)
     c->have_seen_pc = 1;
     npc_next_pos_line_of_sight(d, c, next);
   } else if (c->have_seen_pc) {
-    npc_next_pos_line_of_sight(d, c, next);
+    npc_next_pos_route(d, c, next);
   }
 
   if (c->have_seen_pc &&
@@ -400,7 +358,7 @@ static void npc_next_pos_05(dungeon *d, npc *c, pair_t next)
     c->have_seen_pc = 1;
     npc_next_pos_line_of_sight(d, c, next);
   } else if (c->have_seen_pc) {
-    npc_next_pos_line_of_sight_tunnel(d, c, next);
+    npc_next_pos_route(d, c, next);
   }
 
   if (c->have_seen_pc &&
@@ -428,7 +386,14 @@ static void npc_next_pos_erratic(dungeon *d, npc *c, pair_t next);
 
 static void npc_next_pos_10(dungeon *d, npc *c, pair_t next)
 {
-  npc_next_pos_00(d, c, next);
+  /* pass wall; not smart; not telepathic; not tunneling; not erratic */
+  if (can_see(d, character_get_pos(c), character_get_pos(d->PC), 0, 0)) {
+    c->pc_last_known_position[dim_y] = d->PC->position[dim_y];
+    c->pc_last_known_position[dim_x] = d->PC->position[dim_x];
+    npc_next_pos_line_of_sight(d, c, next);
+  } else {
+    npc_next_pos_rand_pass(d, c, next);
+  }
 }
 
 static void npc_next_pos_11(dungeon *d, npc *c, pair_t next)
@@ -501,7 +466,7 @@ static void npc_next_pos_17(dungeon *d, npc *c, pair_t next)
 static void npc_next_pos_18(dungeon *d, npc *c, pair_t next)
 {
   /* pass wall; not smart; not telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand_pass(d, c, next);
   } else {
     npc_next_pos_10(d, c, next);
@@ -511,7 +476,7 @@ static void npc_next_pos_18(dungeon *d, npc *c, pair_t next)
 static void npc_next_pos_19(dungeon *d, npc *c, pair_t next)
 {
   /* pass wall;     smart; not telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand_pass(d, c, next);
   } else {
     npc_next_pos_11(d, c, next);
@@ -521,7 +486,7 @@ static void npc_next_pos_19(dungeon *d, npc *c, pair_t next)
 static void npc_next_pos_1a(dungeon *d, npc *c, pair_t next)
 {
   /* pass wall; not smart;     telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand_pass(d, c, next);
   } else {
     npc_next_pos_12(d, c, next);
@@ -531,7 +496,7 @@ static void npc_next_pos_1a(dungeon *d, npc *c, pair_t next)
 static void npc_next_pos_1b(dungeon *d, npc *c, pair_t next)
 {
   /* pass wall;     smart;     telepathic; not tunneling;     erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand_pass(d, c, next);
   } else {
     npc_next_pos_13(d, c, next);
@@ -541,7 +506,7 @@ static void npc_next_pos_1b(dungeon *d, npc *c, pair_t next)
 static void npc_next_pos_1c(dungeon *d, npc *c, pair_t next)
 {
   /* pass wall; not smart; not telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand_pass(d, c, next);
   } else {
     npc_next_pos_14(d, c, next);
@@ -551,7 +516,7 @@ static void npc_next_pos_1c(dungeon *d, npc *c, pair_t next)
 static void npc_next_pos_1d(dungeon *d, npc *c, pair_t next)
 {
   /* pass wall;     smart; not telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand_pass(d, c, next);
   } else {
     npc_next_pos_15(d, c, next);
@@ -561,7 +526,7 @@ static void npc_next_pos_1d(dungeon *d, npc *c, pair_t next)
 static void npc_next_pos_1e(dungeon *d, npc *c, pair_t next)
 {
   /* pass wall; not smart;     telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand_pass(d, c, next);
   } else {
     npc_next_pos_16(d, c, next);
@@ -571,7 +536,7 @@ static void npc_next_pos_1e(dungeon *d, npc *c, pair_t next)
 static void npc_next_pos_1f(dungeon *d, npc *c, pair_t next)
 {
   /* pass wall;     smart;     telepathic;     tunneling;     erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand_pass(d, c, next);
   } else {
     npc_next_pos_17(d, c, next);
@@ -620,7 +585,7 @@ void (*npc_move_func[])(dungeon *d, npc *c, pair_t next) = {
 static void npc_next_pos_erratic(dungeon *d, npc *c, pair_t next)
 {
   /*                                               erratic */
-  if (rand() & 1) {
+  if (rng_next(d->rng + rng_npc) & 1) {
     npc_next_pos_rand(d, c, next);
   } else {
     npc_move_func[c->characteristics & 0x00000007](d, c, next);
@@ -632,7 +597,7 @@ void npc_next_pos(dungeon *d, npc *c, pair_t next)
   next[dim_y] = c->position[dim_y];
   next[dim_x] = c->position[dim_x];
 
-  npc_move_func[c->characteristics & 0x0000000f](d, c, next);
+  npc_move_func[c->characteristics & 0x0000001f](d, c, next);
 }
 
 uint32_t dungeon_has_npcs(dungeon *d)
@@ -650,22 +615,23 @@ npc::npc(dungeon *d, monster_description &m) : md(m)
   color = m.color;
   i = 0;
   do {
-    room = rand_range(1, d->num_rooms - 1);
-    p[dim_y] = rand_range(d->rooms[room].position[dim_y],
+    room = rand_range(d->rng + rng_level, 1, d->num_rooms - 1);
+    p[dim_y] = rand_range(d->rng + rng_level, d->rooms[room].position[dim_y],
                           (d->rooms[room].position[dim_y] +
                            d->rooms[room].size[dim_y] - 1));
-    p[dim_x] = rand_range(d->rooms[room].position[dim_x],
+    p[dim_x] = rand_range(d->rng + rng_level, d->rooms[room].position[dim_x],
                           (d->rooms[room].position[dim_x] +
                            d->rooms[room].size[dim_x] - 1));
     i++;
   } while (d->character_map[p[dim_y]][p[dim_x]]);
   pc_last_known_position[dim_y] = p[dim_y];
   pc_last_known_position[dim_x] = p[dim_x];
+  route.length = route.next = 0;
   position[dim_y] = p[dim_y];
   position[dim_x] = p[dim_x];
   d->character_map[p[dim_y]][p[dim_x]] = this;
-  speed = m.speed.roll();
-  hp = m.hitpoints.roll();
+  speed = m.speed.roll(d->rng + rng_level);
+  hp = m.hitpoints.roll(d->rng + rng_level);
   damage = &m.damage;
   alive = 1;
   sequence_number = ++d->character_sequence_number;
@@ -679,6 +645,31 @@ npc::npc(dungeon *d, monster_description &m) : md(m)
   m.birth();
 }
 
+/* A monster coming back with its frozen level.  It was never destroyed, *
+ * so it's still counted as alive, and nothing is rolled; the caller     *
+ * restores whatever the monster had become.                             */
+npc::npc(monster_description &m, pair_t p) : md(m)
+{
+  uint32_t i;
+
+  symbol = m.symbol;
+  color = m.color;
+  position[dim_y] = pc_last_known_position[dim_y] = p[dim_y];
+  position[dim_x] = pc_last_known_position[dim_x] = p[dim_x];
+  route.length = route.next = 0;
+  speed = hp = 0;
+  damage = &m.damage;
+  alive = 1;
+  sequence_number = 0;
+  characteristics = m.abilities;
+  have_seen_pc = 0;
+  name = m.name.c_str();
+  description = (const char *) m.description.c_str();
+  for (i = 0; i < num_kill_types; i++) {
+    kills[i] = 0;
+  }
+}
+
 npc::~npc()
 {
   if (alive) {
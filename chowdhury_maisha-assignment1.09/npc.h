@@ -5,6 +5,7 @@
 
 # include "dims.h"
 # include "character.h"
+# include "path.h"
 
 # define NPC_SMART         0x00000001
 # define NPC_TELEPATH      0x00000002
@@ -50,10 +51,12 @@ typedef uint32_t npc_characteristics_t;
 class npc : public character {
  public:
   npc(dungeon *d, monster_description &m);
+  npc(monster_description &m, pair_t p);
   ~npc();
   npc_characteristics_t characteristics;
   uint32_t have_seen_pc;
   pair_t pc_last_known_position;
+  path_route_t route;
   const char *description;
   monster_description &md;
 };
@@ -5,19 +5,19 @@
 #include "dungeon.h"
 #include "utils.h"
 
-object::object(object_description &o, pair_t p, object *next) :
+object::object(object_description &o, pair_t p, object *next, rng_t *r) :
   name(o.get_name()),
   description(o.get_description()),
   type(o.get_type()),
   color(o.get_color()),
   damage(o.get_damage()),
-  hit(o.get_hit().roll()),
-  dodge(o.get_dodge().roll()),
-  defence(o.get_defence().roll()),
-  weight(o.get_weight().roll()),
-  speed(o.get_speed().roll()),
-  attribute(o.get_attribute().roll()),
-  value(o.get_value().roll()),
+  hit(o.get_hit().roll(r)),
+  dodge(o.get_dodge().roll(r)),
+  defence(o.get_defence().roll(r)),
+  weight(o.get_weight().roll(r)),
+  speed(o.get_speed().roll(r)),
+  attribute(o.get_attribute().roll(r)),
+  value(o.get_value().roll(r)),
   seen(false),
   next(next),
   od(o)
@@ -28,6 +28,49 @@ object::object(object_description &o, pair_t p, object *next) :
   od.generate();
 }
 
+/* Nothing is generated here: a frozen object was never destroyed, so  *
+ * its description still counts it.  The rolls come back as they were. */
+object::object(object_description &o, pair_t p, object *next, FILE *f) :
+  name(o.get_name()),
+  description(o.get_description()),
+  type(o.get_type()),
+  color(o.get_color()),
+  damage(o.get_damage()),
+  next(next),
+  od(o)
+{
+  int32_t rolls[7];
+  uint8_t was_seen;
+
+  if (fread(rolls, sizeof (rolls), 1, f) != 1 ||
+      fread(&was_seen, sizeof (was_seen), 1, f) != 1) {
+    fprintf(stderr, "Frozen level is truncated.\n");
+    exit(-1);
+  }
+  hit = rolls[0];
+  dodge = rolls[1];
+  defence = rolls[2];
+  weight = rolls[3];
+  speed = rolls[4];
+  attribute = rolls[5];
+  value = rolls[6];
+  seen = was_seen;
+
+  position[dim_x] = p[dim_x];
+  position[dim_y] = p[dim_y];
+}
+
+/* Writes what the object rolled when it was generated; the rest comes *
+ * from its description.                                               */
+void object::freeze(FILE *f)
+{
+  int32_t rolls[7] = { hit, dodge, defence, weight, speed, attribute, value };
+  uint8_t was_seen = seen;
+
+  fwrite(rolls, sizeof (rolls), 1, f);
+  fwrite(&was_seen, sizeof (was_seen), 1, f);
+}
+
 object::~object()
 {
   od.destroy();
@@ -45,20 +88,22 @@ void gen_object(dungeon *d)
   int i;
 
   do {
-    i = rand_range(0, v.size() - 1);
-  } while (!v[i].can_be_generated() || !v[i].pass_rarity_roll());
+    i = rand_range(d->rng + rng_level, 0, v.size() - 1);
+  } while (!v[i].can_be_generated() ||
+           !v[i].pass_rarity_roll(d->rng + rng_level));
   
-  room = rand_range(0, d->num_rooms - 1);
+  room = rand_range(d->rng + rng_level, 0, d->num_rooms - 1);
   do {
-    p[dim_y] = rand_range(d->rooms[room].position[dim_y],
+    p[dim_y] = rand_range(d->rng + rng_level, d->rooms[room].position[dim_y],
                           (d->rooms[room].position[dim_y] +
                            d->rooms[room].size[dim_y] - 1));
-    p[dim_x] = rand_range(d->rooms[room].position[dim_x],
+    p[dim_x] = rand_range(d->rng + rng_level, d->rooms[room].position[dim_x],
                           (d->rooms[room].position[dim_x] +
                            d->rooms[room].size[dim_x] - 1));
   } while (mappair(p) > ter_stairs);
 
-  o = new object(v[i], p, d->objmap[p[dim_y]][p[dim_x]]);
+  o = new object(v[i], p, d->objmap[p[dim_y]][p[dim_x]],
+                 d->rng + rng_level);
 
   d->objmap[p[dim_y]][p[dim_x]] = o;
   
@@ -68,7 +113,7 @@ void gen_objects(dungeon *d)
 {
   uint32_t i;
 
-  memset(d->objmap, 0, sizeof (d->objmap));
+  d->objmap.fill(NULL);
 
   for (i = 0; i < d->max_objects; i++) {
     gen_object(d);
@@ -97,17 +142,17 @@ int32_t object::get_speed()
   return speed;
 }
 
-int32_t object::roll_dice()
+int32_t object::roll_dice(rng_t *r)
 {
-  return damage.roll();
+  return damage.roll(r);
 }
 
 void destroy_objects(dungeon *d)
 {
-  uint32_t y, x;
+  int32_t y, x;
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
+  for (y = 0; y < dungeon_y(d); y++) {
+    for (x = 0; x < dungeon_x(d); x++) {
       if (d->objmap[y][x]) {
         delete d->objmap[y][x];
         d->objmap[y][x] = 0;
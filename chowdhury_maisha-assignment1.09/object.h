@@ -2,6 +2,7 @@
 # define OBJECT_H
 
 # include <string>
+# include <stdio.h>
 
 # include "descriptions.h"
 # include "dims.h"
@@ -19,8 +20,12 @@ class object {
   object *next;
   object_description &od;
  public:
-  object(object_description &o, pair_t p, object *next);
+  object(object_description &o, pair_t p, object *next, rng_t *r);
+  /* Brings back an object frozen with its level by freeze(). */
+  object(object_description &o, pair_t p, object *next, FILE *f);
   ~object();
+  void freeze(FILE *f);
+  inline object_description &get_od() { return od; }
   inline int32_t get_damage_base() const
   {
     return damage.get_base();
@@ -37,7 +42,7 @@ class object {
   uint32_t get_color();
   const char *get_name();
   int32_t get_speed();
-  int32_t roll_dice();
+  int32_t roll_dice(rng_t *r);
   int32_t get_type();
   bool have_seen() { return seen; }
   void has_been_seen() { seen = true; }
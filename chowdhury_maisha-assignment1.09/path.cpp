@@ -1,277 +1,1157 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "path.h"
 #include "dungeon.h"
 #include "utils.h"
 #include "pc.h"
+#include "roomgraph.h"
 
-/* Ugly hack: There is no way to pass a pointer to the dungeon into the *
- * heap's comparitor funtion without modifying the heap.  Copying the   *
- * pc_distance array is a possible solution, but that doubles the       *
- * bandwidth requirements for dijkstra, which would also be bad.        *
- * Instead, make a global pointer to the dungeon in this file,          *
- * initialize it in dijkstra, and use it in the comparitor to get to    *
- * pc_distance.  Otherwise, pretend it doesn't exist, because it really *
- * is ugly.                                                             */
-static dungeon *thedungeon;
+/* Edge weights are tiny, bounded integers (always 1 for walkers, and    *
+ * 1 + hardness / 85 <= 3 for tunnelers), so a general-purpose priority  *
+ * queue is overkill.  Instead we use Dial's algorithm: one bucket per   *
+ * distance value, each bucket an intrusive, doubly-linked list threaded *
+ * through per-cell index arrays.  Keys in the queue never span more     *
+ * than a few steps' worth, so 256 buckets, used as a ring, cover any    *
+ * distance.  Insert, decrease-key, and remove-min are all O(1), nothing *
+ * is ever allocated, only cells that have actually been reached are     *
+ * queued, and the whole frontier fits in a few kilobytes.               */
 
-typedef struct path {
-  heap_node_t *hn;
-  uint8_t pos[2];
-} path_t;
+#define PATH_NUM_BUCKETS 256
+#define PATH_BUCKET_MASK (PATH_NUM_BUCKETS - 1)
+#define PATH_NIL         ((cell_index_t) -1)
+#define PATH_UNQUEUED    ((cell_index_t) -2)
+#define PATH_UNREACHED   ((route_cost_t) -1)
 
-static int32_t dist_cmp(const void *key, const void *with) {
-  return ((int32_t) thedungeon->pc_distance[((path_t *) key)->pos[dim_y]]
-                                           [((path_t *) key)->pos[dim_x]] -
-          (int32_t) thedungeon->pc_distance[((path_t *) with)->pos[dim_y]]
-                                           [((path_t *) with)->pos[dim_x]]);
+/* Distances are whatever type D the level's maps are (see              *
+ * distance_grid), and everything that works on them is a template on   *
+ * D, instantiated for each.  The largest D is infinity.  A distance    *
+ * plus a step can run past that, so sums are worked in the next type   *
+ * up.                                                                  */
+#define PATH_INFINITY(D) ((D) -1)
+
+template <class D> struct path_wide;
+template <> struct path_wide<uint8_t> { typedef uint16_t type; };
+template <> struct path_wide<uint16_t> { typedef uint32_t type; };
+template <> struct path_wide<uint32_t> { typedef uint64_t type; };
+
+/* Calls f<D>(d, ...) for d's distance type D. */
+#define PATH_WITH_DISTANCE(d, f, ...)                 \
+  do {                                                \
+    switch ((d)->pc_distance.width()) {               \
+    case sizeof (uint8_t):                            \
+      f<uint8_t>(d, ##__VA_ARGS__);                   \
+      break;                                          \
+    case sizeof (uint16_t):                           \
+      f<uint16_t>(d, ##__VA_ARGS__);                  \
+      break;                                          \
+    default:                                          \
+      f<uint32_t>(d, ##__VA_ARGS__);                  \
+      break;                                          \
+    }                                                 \
+  } while (0)
+
+/* Set to 1 to check every repaired map against a full recompute and *
+ * abort on the first difference.  Slow; for testing only.           */
+#ifndef VERIFY_PATH_REPAIR
+#define VERIFY_PATH_REPAIR 0
+#endif
+
+/* The links live in the context's grids; the queue just points at *
+ * them.                                                            */
+typedef struct bucket_queue {
+  cell_index_t head[PATH_NUM_BUCKETS];
+  cell_index_t *next;
+  cell_index_t *prev;
+  uint8_t *bucket;
+  uint32_t cells;
+  uint32_t cur;
+  uint32_t size;
+} bucket_queue_t;
+
+/* No route costs more than 3 a cell, so it fits in a cell index. */
+typedef cell_index_t route_cost_t;
+
+/* A cell a repair starts from, and the distance it started with. */
+typedef struct path_seed {
+  uint32_t key;
+  cell_index_t cell;
+} path_seed_t;
+
+/* Scratch space.  Nothing in here outlives a single update, but it's *
+ * too big to put on the stack, and if it were static, two dungeons   *
+ * couldn't be worked on at the same time; so each dungeon owns one,  *
+ * and everything below works only on the dungeon it is handed.  The  *
+ * grids are the size of the dungeon's, so a cell has the same index  *
+ * in all of them.                                                    */
+struct path_context {
+  bucket_queue_t queue;
+  dungeon_grid<cell_index_t> next;
+  dungeon_grid<cell_index_t> prev;
+  dungeon_grid<uint8_t> bucket;
+  dungeon_grid<uint8_t> cost;
+  dungeon_grid<cell_index_t> touched;
+  uint32_t num_touched;
+  /* For path_downhill_touched(); all zeros in between. */
+  dungeon_grid<uint8_t> mark;
+  dungeon_grid<route_cost_t> route_cost;
+  dungeon_grid<uint8_t> route_dir;
+  /* For path_downhill_all(), in path_wide<D>::type, so twice as many *
+   * bytes a cell as the distances; classic levels' distances are one *
+   * byte.                                                            */
+  dungeon_grid<uint8_t, 2 * DUNGEON_X, DUNGEON_Y> key;
+  dungeon_grid<uint8_t, 2 * DUNGEON_X, DUNGEON_Y> min_cost;
+  dungeon_grid<uint8_t> walk_dir;
+  dungeon_grid<uint8_t> tunnel_dir;
+  /* Offsets to the eight neighbors in flattened-index space, and the *
+   * same eight in path_step's order, for the dungeon's row stride.   *
+   * Every cell that can be popped is in the interior (the border is  *
+   * immutable rock), so these never leave the map.                   */
+  int32_t neighbor[8];
+  int32_t step_offset[PATH_STAY];
+  /* For repair_map(). */
+  path_seed_t seed[9 * PATH_MAX_DIRTY];
+};
+
+static void bucket_queue_init(bucket_queue_t *q)
+{
+  uint32_t i;
+
+  memset(q->head, 0xff, sizeof (q->head));
+  for (i = 0; i < q->cells; i++) {
+    q->prev[i] = PATH_UNQUEUED;
+  }
+  q->cur = 0;
+  q->size = 0;
 }
 
-static int32_t tunnel_cmp(const void *key, const void *with) {
-  return ((int32_t) thedungeon->pc_tunnel[((path_t *) key)->pos[dim_y]]
-                                         [((path_t *) key)->pos[dim_x]] -
-          (int32_t) thedungeon->pc_tunnel[((path_t *) with)->pos[dim_y]]
-                                         [((path_t *) with)->pos[dim_x]]);
+static inline void bucket_queue_unlink(bucket_queue_t *q, uint32_t i)
+{
+  if (q->prev[i] == PATH_NIL) {
+    q->head[q->bucket[i]] = q->next[i];
+  } else {
+    q->next[q->prev[i]] = q->next[i];
+  }
+  if (q->next[i] != PATH_NIL) {
+    q->prev[q->next[i]] = q->prev[i];
+  }
+  q->prev[i] = PATH_UNQUEUED;
+  q->size--;
 }
 
-void dijkstra(dungeon *d)
+/* Empties the queue, when every cell is already known to be out of it. *
+ * Between searches, that's always the case: a search either runs the  *
+ * queue dry or takes its cells back out itself, so only path_init(),   *
+ * and a repair that gives up halfway, pay for bucket_queue_init().     */
+static void bucket_queue_reset(bucket_queue_t *q)
 {
-  /* Currently assumes that monsters only move on floors.  Will *
-   * need to be modified for tunneling and pass-wall monsters.  */
-
-  heap_t h;
-  uint32_t x, y;
-  static path_t p[DUNGEON_Y][DUNGEON_X], *c;
-  static uint32_t initialized = 0;
-
-  if (!initialized) {
-    initialized = 1;
-    thedungeon = d;
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
-        p[y][x].pos[dim_y] = y;
-        p[y][x].pos[dim_x] = x;
-      }
-    }
+  memset(q->head, 0xff, sizeof (q->head));
+  q->cur = 0;
+  q->size = 0;
+}
+
+/* Inserts i with the given key, or moves it if it is already queued. *
+ * Keys must never be less than the key of the last removed cell.     */
+static inline void bucket_queue_push(bucket_queue_t *q, uint32_t i,
+                                     uint32_t key)
+{
+  uint32_t b;
+
+  if (q->prev[i] != PATH_UNQUEUED) {
+    bucket_queue_unlink(q, i);
   }
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      d->pc_distance[y][x] = 255;
-    }
+  b = key & PATH_BUCKET_MASK;
+  q->bucket[i] = b;
+  q->prev[i] = PATH_NIL;
+  q->next[i] = q->head[b];
+  if (q->head[b] != PATH_NIL) {
+    q->prev[q->head[b]] = i;
+  }
+  q->head[b] = i;
+  q->size++;
+}
+
+static inline uint32_t bucket_queue_pop(bucket_queue_t *q)
+{
+  uint32_t i;
+
+  while (q->head[q->cur & PATH_BUCKET_MASK] == PATH_NIL) {
+    q->cur++;
   }
-  d->pc_distance[d->PC->position[dim_y]][d->PC->position[dim_x]] = 0;
+  i = q->head[q->cur & PATH_BUCKET_MASK];
+  bucket_queue_unlink(q, i);
 
-  heap_init(&h, dist_cmp, NULL);
+  return i;
+}
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      if (mapxy(x, y) >= ter_floor) {
-        p[y][x].hn = heap_insert(&h, &p[y][x]);
-      }
-    }
+/* Ignores the case of hardness == 255, because if *
+ * that gets here, there's already been an error.  */
+#define tunnel_movement_cost(h) (((h) / HARDNESS_PER_TURN) + 1)
+
+/* Both maps are built from the same terrain, so rather than have each *
+ * sweep reread the map and hardness arrays, fold everything either    *
+ * one needs into a single byte per cell: the cost of leaving the cell *
+ * on foot in the low nibble and the cost of tunneling out of it in    *
+ * the high nibble, with zero meaning the cell can't be entered at     *
+ * all.  Both frontiers then expand out of the same 1.6KB array.       */
+#define PATH_COST_SHIFT(m) ((m) == path_tunnel ? 4 : 0)
+#define PATH_COST_MASK     0xf
+
+static void path_build_costs(dungeon *d)
+{
+  terrain_type *map;
+  uint8_t *hardness, *path_cost;
+  uint32_t i;
+
+  path_cost = d->paths.context->cost.data();
+  map = &d->map[0][0];
+  hardness = &d->hardness[0][0];
+
+  for (i = 0; i < dungeon_cells(d); i++) {
+    path_cost[i] = (((map[i] >= ter_floor) << PATH_COST_SHIFT(path_walk)) |
+                    (((map[i] != ter_wall_immutable) *
+                      tunnel_movement_cost(hardness[i])) <<
+                     PATH_COST_SHIFT(path_tunnel)));
   }
+}
+
+/* Every step on foot costs the same, so the walking map doesn't need a  *
+ * priority queue at all: cells come off a plain FIFO in distance order, *
+ * are final the first time they are reached, and are never requeued.    */
+template <class D>
+static void path_fill_walk(dungeon *d, cell_index_t *fifo)
+{
+  const int32_t *neighbor = d->paths.context->neighbor;
+  uint8_t *path_cost;
+  D *dist;
+  uint32_t head, tail, c, n, i;
+  typename path_wide<D>::type cost;
+
+  path_cost = d->paths.context->cost.data();
+  dist = d->pc_distance.cells<D>();
+  memset(dist, 0xff, dungeon_cells(d) * sizeof (*dist));
+  d->pc_distance.set_bias(0);
+
+  c = cell_index(d, d->PC->position[dim_x], d->PC->position[dim_y]);
+  dist[c] = 0;
+  fifo[0] = c;
+  head = 0;
+  tail = 1;
+
+  d->paths.source[path_walk][dim_x] = d->PC->position[dim_x];
+  d->paths.source[path_walk][dim_y] = d->PC->position[dim_y];
+  d->paths.valid[path_walk] = 1;
+  d->paths.map_generation[path_walk] = d->paths.generation;
+  d->paths.stale[path_walk] = 0;
 
-  while ((c = (path_t *) heap_remove_min(&h))) {
-    c->hn = NULL;
-    if ((p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn) &&
-        (d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x] - 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn);
+  while (head != tail) {
+    c = fifo[head++];
+    if ((cost = dist[c] + 1) >= PATH_INFINITY(D)) {
+      continue;
     }
-    if ((p[c->pos[dim_y] - 1][c->pos[dim_x]    ].hn) &&
-        (d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x]    ] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x]    ] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] - 1][c->pos[dim_x]    ].hn);
+    for (i = 0; i < 8; i++) {
+      n = c + neighbor[i];
+      if (dist[n] == PATH_INFINITY(D) &&
+          (path_cost[n] >> PATH_COST_SHIFT(path_walk)) & PATH_COST_MASK) {
+        dist[n] = cost;
+        fifo[tail++] = n;
+      }
     }
-    if ((p[c->pos[dim_y] - 1][c->pos[dim_x] + 1].hn) &&
-        (d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x] + 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] - 1][c->pos[dim_x] + 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] - 1][c->pos[dim_x] + 1].hn);
+  }
+}
+
+/* As before, the cost of leaving a cell is charged at that cell. */
+template <class D>
+static void path_fill_tunnel(dungeon *d, bucket_queue_t *q)
+{
+  const int32_t *neighbor = d->paths.context->neighbor;
+  uint8_t *path_cost;
+  D *dist;
+  uint32_t c, n, i;
+  typename path_wide<D>::type cost;
+
+  path_cost = d->paths.context->cost.data();
+  dist = d->pc_tunnel.cells<D>();
+  memset(dist, 0xff, dungeon_cells(d) * sizeof (*dist));
+  d->pc_tunnel.set_bias(0);
+
+  bucket_queue_reset(q);
+  c = cell_index(d, d->PC->position[dim_x], d->PC->position[dim_y]);
+  dist[c] = 0;
+  bucket_queue_push(q, c, 0);
+
+  d->paths.source[path_tunnel][dim_x] = d->PC->position[dim_x];
+  d->paths.source[path_tunnel][dim_y] = d->PC->position[dim_y];
+  d->paths.valid[path_tunnel] = 1;
+  d->paths.map_generation[path_tunnel] = d->paths.generation;
+  d->paths.stale[path_tunnel] = 0;
+
+  while (q->size) {
+    c = bucket_queue_pop(q);
+    if ((cost = dist[c] + ((path_cost[c] >> PATH_COST_SHIFT(path_tunnel)) &
+                           PATH_COST_MASK)) >= PATH_INFINITY(D)) {
+      continue;
     }
-    if ((p[c->pos[dim_y]    ][c->pos[dim_x] - 1].hn) &&
-        (d->pc_distance[c->pos[dim_y]    ][c->pos[dim_x] - 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y]    ][c->pos[dim_x] - 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y]    ][c->pos[dim_x] - 1].hn);
+    for (i = 0; i < 8; i++) {
+      n = c + neighbor[i];
+      if (dist[n] > cost &&
+          (path_cost[n] >> PATH_COST_SHIFT(path_tunnel)) & PATH_COST_MASK) {
+        dist[n] = cost;
+        bucket_queue_push(q, n, cost);
+      }
     }
-    if ((p[c->pos[dim_y]    ][c->pos[dim_x] + 1].hn) &&
-        (d->pc_distance[c->pos[dim_y]    ][c->pos[dim_x] + 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y]    ][c->pos[dim_x] + 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y]    ][c->pos[dim_x] + 1].hn);
+  }
+}
+
+/* Monsters that follow the gradient want the best step out of their   *
+ * cell, not the distance itself, and there are far more monster moves *
+ * than map updates, so work the steps out whenever the maps change.   *
+ * Directions are tried in the order monsters have always tried them   *
+ * (preferring cardinal directions), so that ties break the same way.  */
+const int8_t path_step[PATH_STAY + 1][num_dims] = {
+  {  0, -1 }, {  0,  1 }, {  1,  0 }, { -1,  0 },
+  {  1, -1 }, {  1,  1 }, { -1, -1 }, { -1,  1 },
+  {  0,  0 }
+};
+
+/* Walkers take the first step that gets them any closer, and stay put *
+ * if there isn't one.  Tunnelers take the step with the least total   *
+ * of distance plus time spent digging, and always go somewhere.       */
+template <class D>
+static inline uint32_t path_walk_downhill(dungeon *d, uint32_t c)
+{
+  const int32_t *step_offset = d->paths.context->step_offset;
+  D *dist;
+  uint32_t walk_dir;
+
+  dist = d->pc_distance.cells<D>();
+
+  for (walk_dir = 0;
+       walk_dir < PATH_STAY && dist[c + step_offset[walk_dir]] >= dist[c];
+       walk_dir++)
+    ;
+
+  return walk_dir;
+}
+
+template <class D>
+static inline uint32_t path_tunnel_downhill(dungeon *d, uint32_t c)
+{
+  const int32_t *step_offset = d->paths.context->step_offset;
+  D *tunnel;
+  uint8_t *hardness;
+  uint32_t tunnel_dir, n, i;
+  typename path_wide<D>::type cost, min_cost;
+
+  tunnel = d->pc_tunnel.cells<D>();
+  hardness = &d->hardness[0][0];
+
+  n = c + step_offset[0];
+  min_cost = (typename path_wide<D>::type) tunnel[n] +
+             hardness[n] / HARDNESS_PER_TURN;
+  for (tunnel_dir = 0, i = 1; i < PATH_STAY; i++) {
+    n = c + step_offset[i];
+    if ((cost = ((typename path_wide<D>::type) tunnel[n] +
+                 hardness[n] / HARDNESS_PER_TURN)) < min_cost) {
+      min_cost = cost;
+      tunnel_dir = i;
     }
-    if ((p[c->pos[dim_y] + 1][c->pos[dim_x] - 1].hn) &&
-        (d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x] - 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x] - 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] + 1][c->pos[dim_x] - 1].hn);
+  }
+
+  return tunnel_dir;
+}
+
+template <class D>
+static inline void path_downhill(dungeon *d, uint32_t c)
+{
+  (&d->pc_downhill[0][0])[c] = (path_walk_downhill<D>(d, c) |
+                                (path_tunnel_downhill<D>(d, c) << 4));
+}
+
+/* Works out c's steps, if monsters could ever be standing there. */
+template <class D>
+static inline void path_downhill_cell(dungeon *d, uint32_t c)
+{
+  int32_t x, y;
+
+  x = c % dungeon_stride(d);
+  y = c / dungeon_stride(d);
+  if (x > 0 && x < dungeon_x(d) - 1 && y > 0 && y < dungeon_y(d) - 1) {
+    path_downhill<D>(d, c);
+  } else {
+    (&d->pc_downhill[0][0])[c] = PATH_STAY | (PATH_STAY << 4);
+  }
+}
+
+/* Same as path_downhill() on every cell, but a direction at a time over *
+ * one flat run of cells, so that the inner loops are straight-line      *
+ * compares and selects over contiguous arrays, which vectorize.  The    *
+ * run ignores row ends and is a whole number of vectors long, starting  *
+ * and ending far enough in that no neighbor falls off the map; the      *
+ * edge columns it passes over, and the cells it doesn't reach, are      *
+ * fixed up one at a time afterward.  Walk directions are tried in       *
+ * reverse, so that the first one that goes downhill wins.               */
+#define PATH_RUN_START(d) (dungeon_stride(d) + 16)
+#define PATH_RUN_END(d)   ((dungeon_y(d) - 1) * dungeon_stride(d) - 16)
+
+/* The straight-line part, apart so that the compiler can be told that *
+ * none of these overlap, which it needs to know to vectorize them.    */
+template <class D>
+static void path_downhill_run(const D *__restrict__ dist,
+                              const D *__restrict__ tunnel,
+                              const uint8_t *__restrict__ hardness,
+                              typename path_wide<D>::type *__restrict__ key,
+                              typename path_wide<D>::type
+                                *__restrict__ min_cost,
+                              uint8_t *__restrict__ walk_dir,
+                              uint8_t *__restrict__ tunnel_dir,
+                              uint8_t *__restrict__ downhill,
+                              const int32_t *step_offset, uint32_t cells,
+                              uint32_t start, uint32_t end)
+{
+  typedef typename path_wide<D>::type wide_t;
+  const D *to;
+  const wide_t *to_key;
+  uint32_t c, i;
+
+  for (c = 0; c < cells; c++) {
+    key[c] = (wide_t) tunnel[c] + hardness[c] / HARDNESS_PER_TURN;
+  }
+
+  for (c = start; c < end; c++) {
+    walk_dir[c] = PATH_STAY;
+    tunnel_dir[c] = 0;
+    min_cost[c] = key[c + step_offset[0]];
+  }
+  for (i = PATH_STAY; i--;) {
+    to = dist + step_offset[i];
+    for (c = start; c < end; c++) {
+      walk_dir[c] = to[c] < dist[c] ? i : walk_dir[c];
     }
-    if ((p[c->pos[dim_y] + 1][c->pos[dim_x]    ].hn) &&
-        (d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x]    ] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x]    ] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] + 1][c->pos[dim_x]    ].hn);
+  }
+  for (i = 1; i < PATH_STAY; i++) {
+    to_key = key + step_offset[i];
+    for (c = start; c < end; c++) {
+      tunnel_dir[c] = to_key[c] < min_cost[c] ? i : tunnel_dir[c];
+      min_cost[c] = to_key[c] < min_cost[c] ? to_key[c] : min_cost[c];
     }
-    if ((p[c->pos[dim_y] + 1][c->pos[dim_x] + 1].hn) &&
-        (d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x] + 1] >
-         d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1)) {
-      d->pc_distance[c->pos[dim_y] + 1][c->pos[dim_x] + 1] =
-        d->pc_distance[c->pos[dim_y]][c->pos[dim_x]] + 1;
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] + 1][c->pos[dim_x] + 1].hn);
+  }
+  for (c = start; c < end; c++) {
+    downhill[c] = walk_dir[c] | (tunnel_dir[c] << 4);
+  }
+}
+
+template <class D>
+static void path_downhill_all(dungeon *d)
+{
+  typedef typename path_wide<D>::type wide_t;
+  path_context_t *ctx = d->paths.context;
+  const uint32_t start = PATH_RUN_START(d), end = PATH_RUN_END(d);
+  uint8_t *downhill;
+  uint32_t c;
+  int32_t y;
+
+  downhill = &d->pc_downhill[0][0];
+
+  path_downhill_run<D>(d->pc_distance.cells<D>(), d->pc_tunnel.cells<D>(),
+                       &d->hardness[0][0], (wide_t *) ctx->key.data(),
+                       (wide_t *) ctx->min_cost.data(),
+                       ctx->walk_dir.data(), ctx->tunnel_dir.data(),
+                       downhill, ctx->step_offset, dungeon_cells(d),
+                       start, end);
+
+  for (c = 0; c < start; c++) {
+    path_downhill_cell<D>(d, c);
+  }
+  for (c = end; c < dungeon_cells(d); c++) {
+    path_downhill_cell<D>(d, c);
+  }
+  for (y = 0; y < dungeon_y(d); y++) {
+    downhill[cell_index(d, 0, y)] = PATH_STAY | (PATH_STAY << 4);
+    downhill[cell_index(d, dungeon_x(d) - 1, y)] = (PATH_STAY |
+                                                    (PATH_STAY << 4));
+  }
+}
+
+/* Refreshes c and every cell that can step into c. */
+template <class D>
+static void path_downhill_around(dungeon *d, uint32_t c)
+{
+  const int32_t *neighbor = d->paths.context->neighbor;
+  uint32_t i;
+
+  for (i = 0; i < 8; i++) {
+    path_downhill_cell<D>(d, c + neighbor[i]);
+  }
+  path_downhill_cell<D>(d, c);
+}
+
+/* Refreshes m's steps out of every cell around the cells a repair of *
+ * m has touched (the first num_touched in the context's list), each   *
+ * of them once, where path_downhill_around() on each touched cell     *
+ * would do most of them nine times over.  Cells that weren't touched, *
+ * with no neighbors that were, have all moved by the same bias, so    *
+ * their steps are as they were; and the other map hasn't changed at   *
+ * all.  The cells around the touched ones are added to the end of the *
+ * list as they're marked, so that the marks can be taken back off     *
+ * without clearing the whole map.  Only immutable rock can be on the  *
+ * edge of the map, so only it needs path_downhill_cell()'s checks.    */
+template <class D>
+static void path_downhill_touched(dungeon *d, path_map_t m)
+{
+  path_context_t *ctx = d->paths.context;
+  const int32_t *neighbor = ctx->neighbor;
+  cell_index_t *touched;
+  terrain_type *map;
+  uint8_t *mark, *downhill;
+  uint32_t num, c, n, i, j;
+
+  touched = ctx->touched.data();
+  mark = ctx->mark.data();
+  map = &d->map[0][0];
+  downhill = &d->pc_downhill[0][0];
+
+  for (i = 0; i < ctx->num_touched; i++) {
+    mark[touched[i]] = 1;
+  }
+  for (num = ctx->num_touched, i = 0; i < ctx->num_touched; i++) {
+    c = touched[i];
+    for (j = 0; j < 9; j++) {
+      n = j < 8 ? c + neighbor[j] : c;
+      if (mark[n] == 2) {
+        continue;
+      }
+      if (!mark[n]) {
+        touched[num++] = n;
+      }
+      mark[n] = 2;
+      if (map[n] == ter_wall_immutable) {
+        path_downhill_cell<D>(d, n);
+      } else if (m == path_walk) {
+        downhill[n] = (downhill[n] & 0xf0) | path_walk_downhill<D>(d, n);
+      } else {
+        downhill[n] = ((downhill[n] & 0xf) |
+                       (path_tunnel_downhill<D>(d, n) << 4));
+      }
     }
   }
-  heap_delete(&h);
+  for (i = 0; i < num; i++) {
+    mark[touched[i]] = 0;
+  }
 }
 
-/* Ignores the case of hardness == 255, because if *
- * that gets here, there's already been an error.  */
-#define tunnel_movement_cost(x, y)                      \
-  ((d->hardness[y][x] / 85) + 1)
+/* Past some share of the map, one cell at a time is slower than all *
+ * at once: half of it, or only an eighth with one-byte distances,    *
+ * which path_downhill_all() gets through many to an instruction.     */
+#define PATH_DOWNHILL_ALL_AT(D, d) \
+  (dungeon_cells(d) / (sizeof (D) == sizeof (uint8_t) ? 8 : 2))
+
+/* Rebuilds whichever maps are requested with a single pass over the *
+ * terrain.  The two frontiers run back to back rather than in lock  *
+ * step; everything fits in L1 either way, and alternating between   *
+ * them was measurably slower.                                       */
+template <class D>
+static void path_sweep(dungeon *d, uint32_t walk, uint32_t tunnel)
+{
+  bucket_queue_t *q;
+
+  q = &d->paths.context->queue;
+
+  path_build_costs(d);
+
+  if (walk) {
+    /* Nothing else is using the queue's link array yet. */
+    path_fill_walk<D>(d, q->next);
+  }
+  if (tunnel) {
+    path_fill_tunnel<D>(d, q);
+  }
+
+  path_downhill_all<D>(d);
+}
+
+void compute_pc_distance_fields(dungeon *d)
+{
+  PATH_WITH_DISTANCE(d, path_sweep, 1, 1);
+}
+
+void dijkstra(dungeon *d)
+{
+  PATH_WITH_DISTANCE(d, path_sweep, 1, 0);
+}
 
 void dijkstra_tunnel(dungeon *d)
 {
-  /* Currently assumes that monsters only move on floors.  Will *
-   * need to be modified for tunneling and pass-wall monsters.  */
+  PATH_WITH_DISTANCE(d, path_sweep, 0, 1);
+}
 
-  heap_t h;
-  uint32_t x, y;
-  uint32_t size;
-  static path_t p[DUNGEON_Y][DUNGEON_X], *c;
-  static uint32_t initialized = 0;
-
-  if (!initialized) {
-    initialized = 1;
-    thedungeon = d;
-    for (y = 0; y < DUNGEON_Y; y++) {
-      for (x = 0; x < DUNGEON_X; x++) {
-        p[y][x].pos[dim_y] = y;
-        p[y][x].pos[dim_x] = x;
-      }
+/* Incremental repair.  If the PC has moved from s to s', the new        *
+ * distance to any cell v is at most the cost of getting from s' back to *
+ * s plus the old distance to v, and walking the old shortest path from  *
+ * s to s' in reverse costs at most k = D(s') + cost(s') - 1 (the first  *
+ * and last cells trade places in the sum, and leaving any cell costs at *
+ * least one).  Terrain only ever gets softer, so the old distances plus *
+ * k are valid upper bounds.  Rather than add k to every cell, take it   *
+ * off the map's bias, which leaves every cell holding its bound as is;  *
+ * only when the bias runs out does every cell get rewritten, with a new *
+ * bias halfway up whatever room the map's largest distance leaves.      *
+ * Start from those bounds and run Dijkstra from s'.  A cell that is     *
+ * already at its bound can never lower a neighbor below that neighbor's *
+ * bound, so cells whose distance goes up by the full k are never        *
+ * expanded at all; only the region that gets relatively closer is       *
+ * touched.  Cells around terrain changes have new or cheaper edges, so  *
+ * those are expanded unconditionally.  The result is exactly what a     *
+ * full rebuild would produce, give or take the bias.                    */
+
+static inline uint32_t in_graph(const terrain_type *map, uint32_t tunnel,
+                                uint32_t i)
+{
+  return tunnel ? map[i] != ter_wall_immutable : map[i] >= ter_floor;
+}
+
+/* The cells around terrain changes can be anywhere on the map, at any *
+ * distance, far more than the bucket ring spans on a big level.  So   *
+ * they wait, in order of distance, and join the queue only once the   *
+ * frontier comes within reach of them, with room left in the ring for *
+ * the costliest step.  One that the frontier has already improved on  *
+ * is in the queue anyway, and doesn't need to be.                     */
+#define PATH_SEED_REACH (PATH_NUM_BUCKETS - 1 - tunnel_movement_cost(254))
+
+static int compare_seed(const void *v1, const void *v2)
+{
+  const path_seed_t *s1 = (const path_seed_t *) v1;
+  const path_seed_t *s2 = (const path_seed_t *) v2;
+
+  if (s1->key != s2->key) {
+    return s1->key < s2->key ? -1 : 1;
+  }
+
+  return (s1->cell > s2->cell) - (s1->cell < s2->cell);
+}
+
+/* Adds k to every distance in g the hard way, for when its bias is too *
+ * small to take k off of.  Returns 0 if the distances no longer fit.   */
+template <class D>
+static uint32_t path_rebias(dungeon *d, distance_grid *g,
+                            typename path_wide<D>::type k)
+{
+  typedef typename path_wide<D>::type wide_t;
+  D *dist;
+  wide_t top, shift;
+  uint32_t i;
+
+  dist = g->cells<D>();
+
+  for (top = 0, i = 0; i < dungeon_cells(d); i++) {
+    if (dist[i] != PATH_INFINITY(D) && dist[i] > top) {
+      top = dist[i];
     }
   }
+  if ((top = top - g->bias() + k) >= PATH_INFINITY(D)) {
+    return 0;
+  }
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      d->pc_tunnel[y][x] = 255;
+  /* The new bias, plus k, less the old one, which can't be bigger. */
+  shift = (PATH_INFINITY(D) - 1 - top) / 2 + k;
+  for (i = 0; i < dungeon_cells(d); i++) {
+    if (dist[i] != PATH_INFINITY(D)) {
+      dist[i] = dist[i] + shift - g->bias();
     }
   }
-  d->pc_tunnel[d->PC->position[dim_y]][d->PC->position[dim_x]] = 0;
+  g->set_bias((PATH_INFINITY(D) - 1 - top) / 2);
+
+  return 1;
+}
+
+template <class D>
+static uint32_t repair_map(dungeon *d, uint32_t tunnel)
+{
+  path_context_t *ctx;
+  const int32_t *neighbor;
+  bucket_queue_t *q;
+  terrain_type *map;
+  uint8_t *hardness;
+  distance_grid *g;
+  D *dist;
+  path_seed_t *seed;
+  uint32_t source, old, c, n, i, j, s, num_seeds;
+  typename path_wide<D>::type k, cost;
+
+  if (!d->paths.valid[tunnel] ||
+      d->paths.map_generation[tunnel] < d->paths.dirty_base) {
+    return 0;
+  }
+
+  ctx = d->paths.context;
+  neighbor = ctx->neighbor;
+  q = &ctx->queue;
+  seed = ctx->seed;
+  map = &d->map[0][0];
+  hardness = &d->hardness[0][0];
+  g = tunnel ? &d->pc_tunnel : &d->pc_distance;
+  dist = g->cells<D>();
+  source = cell_index(d, d->PC->position[dim_x], d->PC->position[dim_y]);
+  old = cell_index(d, d->paths.source[tunnel][dim_x],
+                   d->paths.source[tunnel][dim_y]);
 
-  heap_init(&h, tunnel_cmp, NULL);
+  bucket_queue_reset(q);
+  ctx->num_touched = 0;
 
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      if (mapxy(x, y) != ter_wall_immutable) {
-        p[y][x].hn = heap_insert(&h, &p[y][x]);
+  if (source != old) {
+    /* Walking back into the old source only works if it's walkable. */
+    if (dist[source] == PATH_INFINITY(D) ||
+        (!tunnel && map[old] < ter_floor)) {
+      return 0;
+    }
+    k = dist[source] - g->bias();
+    if (tunnel) {
+      k += tunnel_movement_cost(hardness[source]) - 1;
+    }
+    if (k <= g->bias()) {
+      g->set_bias(g->bias() - k);
+    } else if (!path_rebias<D>(d, g, k)) {
+      return 0;
+    }
+    dist[source] = g->bias();
+    q->cur = g->bias();
+    bucket_queue_push(q, source, g->bias());
+  }
+  for (num_seeds = 0, j = (d->paths.map_generation[tunnel] -
+                           d->paths.dirty_base);
+       j < d->paths.num_dirty;
+       j++) {
+    c = cell_index(d, d->paths.dirty[j][dim_x], d->paths.dirty[j][dim_y]);
+    for (i = 0; i < 9; i++) {
+      n = i < 8 ? c + neighbor[i] : c;
+      if (dist[n] != PATH_INFINITY(D) && in_graph(map, tunnel, n)) {
+        seed[num_seeds].key = dist[n];
+        seed[num_seeds++].cell = n;
       }
     }
   }
+  qsort(seed, num_seeds, sizeof (*seed), compare_seed);
 
-  size = h.size;
-  while ((c = (path_t *) heap_remove_min(&h))) {
-    if (--size != h.size) {
-      exit(1);
+  for (s = 0; ; ) {
+    for (; (s < num_seeds &&
+            (!q->size || seed[s].key <= q->cur + PATH_SEED_REACH)); s++) {
+      n = seed[s].cell;
+      if (dist[n] != seed[s].key ||
+          (s && seed[s - 1].cell == n)) {
+        continue;
+      }
+      if (!q->size) {
+        q->cur = seed[s].key;
+      }
+      bucket_queue_push(q, n, seed[s].key);
+    }
+    if (!q->size) {
+      break;
+    }
+    c = bucket_queue_pop(q);
+    ctx->touched.data()[ctx->num_touched++] = c;
+    if ((cost = dist[c] + (tunnel ? tunnel_movement_cost(hardness[c]) : 1)) >=
+        PATH_INFINITY(D)) {
+      /* Only a rebuild, without the bias, can tell if that's too far. */
+      if (g->bias()) {
+        bucket_queue_init(q);
+        return 0;
+      }
+      continue;
     }
-    c->hn = NULL;
-    if ((p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x] - 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x] - 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] - 1][c->pos[dim_x] - 1].hn);
+    for (i = 0; i < 8; i++) {
+      n = c + neighbor[i];
+      if (in_graph(map, tunnel, n) && dist[n] > cost) {
+        dist[n] = cost;
+        bucket_queue_push(q, n, cost);
+      }
     }
-    if ((p[c->pos[dim_y] - 1][c->pos[dim_x]    ].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x]    ] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x]    ] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] - 1][c->pos[dim_x]    ].hn);
+  }
+
+  d->paths.source[tunnel][dim_x] = d->PC->position[dim_x];
+  d->paths.source[tunnel][dim_y] = d->PC->position[dim_y];
+  d->paths.map_generation[tunnel] = d->paths.generation;
+
+  return 1;
+}
+
+/* Brings one map up to date, by repair if possible, otherwise by a *
+ * full rebuild.                                                    */
+template <class D>
+static void path_update(dungeon *d, path_map_t m)
+{
+#if VERIFY_PATH_REPAIR
+  distance_grid check(DUNGEON_X, DUNGEON_Y);
+  distance_grid *g;
+  dungeon_grid<uint8_t> downhill_check;
+  int32_t x, y;
+#endif
+
+  if (!repair_map<D>(d, m)) {
+    path_sweep<D>(d, m == path_walk, m == path_tunnel);
+    d->paths.rebuilds[m]++;
+  } else {
+    if (d->paths.context->num_touched > PATH_DOWNHILL_ALL_AT(D, d)) {
+      path_downhill_all<D>(d);
+    } else {
+      path_downhill_touched<D>(d, m);
     }
-    if ((p[c->pos[dim_y] - 1][c->pos[dim_x] + 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x] + 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] - 1][c->pos[dim_x] + 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] - 1][c->pos[dim_x] + 1].hn);
+    d->paths.repairs[m]++;
+  }
+  d->paths.stale[m] = 0;
+  d->paths.used[m] = 1;
+
+  /* Once both maps have caught up, nobody needs the history. */
+  if (d->paths.map_generation[path_walk] == d->paths.generation &&
+      d->paths.map_generation[path_tunnel] == d->paths.generation) {
+    d->paths.dirty_base = d->paths.generation;
+    d->paths.num_dirty = 0;
+  }
+
+#if VERIFY_PATH_REPAIR
+  g = m == path_tunnel ? &d->pc_tunnel : &d->pc_distance;
+  check.copy(*g);
+  downhill_check.copy(d->pc_downhill);
+  path_sweep<D>(d, m == path_walk, m == path_tunnel);
+  for (y = 0; y < dungeon_y(d); y++) {
+    for (x = 0; x < dungeon_x(d); x++) {
+      if (check.at(x, y) != g->at(x, y)) {
+        break;
+      }
+    }
+    if (x < dungeon_x(d)) {
+      break;
+    }
+  }
+  if (y < dungeon_y(d)                                           ||
+      memcmp(downhill_check.data(), d->pc_downhill.data(),
+             dungeon_cells(d))) {
+    fprintf(stderr, "Repaired distance map differs from full recompute "
+            "with PC at %d, %d.\n",
+            d->PC->position[dim_x], d->PC->position[dim_y]);
+    abort();
+  }
+  /* Carry on from the repaired map, bias and all, not the rebuilt one. */
+  g->copy(check);
+#endif
+}
+
+/* Nothing computes the distance maps up front anymore; instead, *
+ * everything that reads one asks for it first, and it gets      *
+ * brought up to date then, if it needs to be.  Levels where     *
+ * nobody follows the gradient never build them at all.          */
+void path_ensure(dungeon *d, path_map_t m)
+{
+  if (d->paths.stale[m]                                          ||
+      d->paths.source[m][dim_x] != d->PC->position[dim_x]        ||
+      d->paths.source[m][dim_y] != d->PC->position[dim_y]) {
+    PATH_WITH_DISTANCE(d, path_update, m);
+  } else {
+    d->paths.used[m] = 1;
+  }
+}
+
+/* The PC moving and tunnelers breaking through rock are where the  *
+ * maps used to be rebuilt unconditionally; if nobody has looked at *
+ * a map since the last time, that rebuild would have been wasted.  */
+static void path_mark_stale(dungeon *d, uint32_t would_rebuild)
+{
+  uint32_t m;
+
+  for (m = 0; m < num_path_maps; m++) {
+    if (would_rebuild) {
+      if (!d->paths.used[m]) {
+        d->paths.skipped[m]++;
+      }
+      d->paths.used[m] = 0;
     }
-    if ((p[c->pos[dim_y]    ][c->pos[dim_x] - 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y]    ][c->pos[dim_x] - 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y]    ][c->pos[dim_x] - 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y]    ][c->pos[dim_x] - 1].hn);
+    d->paths.stale[m] = 1;
+  }
+}
+
+/* Sizes the scratch space to the dungeon, which must already be sized. */
+void path_init(dungeon *d)
+{
+  path_context_t *ctx;
+  int32_t x, y, s;
+
+  if (!(ctx = d->paths.context)) {
+    ctx = d->paths.context = new path_context_t;
+  }
+
+  x = dungeon_x(d);
+  y = dungeon_y(d);
+  s = dungeon_stride(d);
+  ctx->next.resize(x, y);
+  ctx->prev.resize(x, y);
+  ctx->bucket.resize(x, y);
+  ctx->cost.resize(x, y);
+  ctx->touched.resize(x, y);
+  ctx->mark.resize(x, y);
+  ctx->mark.fill(0);
+  ctx->route_cost.resize(x, y);
+  ctx->route_cost.fill(PATH_UNREACHED);
+  ctx->route_dir.resize(x, y);
+  ctx->key.resize(2 * d->pc_distance.width() * s, y);
+  ctx->min_cost.resize(2 * d->pc_distance.width() * s, y);
+  ctx->walk_dir.resize(x, y);
+  ctx->tunnel_dir.resize(x, y);
+  ctx->queue.next = ctx->next.data();
+  ctx->queue.prev = ctx->prev.data();
+  ctx->queue.bucket = ctx->bucket.data();
+  ctx->queue.cells = dungeon_cells(d);
+  bucket_queue_init(&ctx->queue);
+
+  ctx->neighbor[0] = -s - 1;
+  ctx->neighbor[1] = -s;
+  ctx->neighbor[2] = -s + 1;
+  ctx->neighbor[3] = -1;
+  ctx->neighbor[4] = 1;
+  ctx->neighbor[5] = s - 1;
+  ctx->neighbor[6] = s;
+  ctx->neighbor[7] = s + 1;
+  for (x = 0; x < PATH_STAY; x++) {
+    ctx->step_offset[x] = path_step[x][dim_y] * s + path_step[x][dim_x];
+  }
+
+  path_invalidate(d);
+}
+
+void path_delete(dungeon *d)
+{
+  delete d->paths.context;
+  d->paths.context = NULL;
+}
+
+void path_invalidate(dungeon *d)
+{
+  d->paths.valid[path_walk] = d->paths.valid[path_tunnel] = 0;
+  d->paths.stale[path_walk] = d->paths.stale[path_tunnel] = 1;
+  d->paths.used[path_walk] = d->paths.used[path_tunnel] = 1;
+  d->paths.dirty_base = d->paths.generation;
+  d->paths.num_dirty = 0;
+  d->paths.floor_generation++;
+}
+
+void path_note_pc_moved(dungeon *d)
+{
+  path_mark_stale(d, 1);
+}
+
+/* Tunnelers chip away at rock, and sometimes break through it.  Either *
+ * way, movement costs change; remember where, so that the next repair  *
+ * can account for it.  Terrain may only get softer, never harder.      *
+ * Tunnelers weigh the hardness of the cells around them, so their      *
+ * steps into this cell change right away, maps or no maps.  If the     *
+ * history fills up, start over; maps that haven't seen what was lost   *
+ * will be rebuilt from scratch.                                        */
+void path_note_terrain_change(dungeon *d, pair_t pos)
+{
+  PATH_WITH_DISTANCE(d, path_downhill_around,
+                     cell_index(d, pos[dim_x], pos[dim_y]));
+
+  if (d->paths.num_dirty == PATH_MAX_DIRTY) {
+    d->paths.dirty_base += d->paths.num_dirty;
+    d->paths.num_dirty = 0;
+  }
+  d->paths.dirty[d->paths.num_dirty][dim_x] = pos[dim_x];
+  d->paths.dirty[d->paths.num_dirty][dim_y] = pos[dim_y];
+  d->paths.num_dirty++;
+  d->paths.generation++;
+
+  if (d->map[pos[dim_y]][pos[dim_x]] >= ter_floor) {
+    d->paths.floor_generation++;
+  }
+
+  path_mark_stale(d, d->map[pos[dim_y]][pos[dim_x]] >= ter_floor);
+}
+
+/* Goal-directed search, for monsters that are after some particular    *
+ * cell rather than the PC, and don't know enough to use the maps.  A*,  *
+ * with the number of king's moves left as the heuristic, which can't    *
+ * overestimate because no step costs less than one.  It's consistent,   *
+ * too, so keys come off the queue in order and the bucket queue works   *
+ * as is; the open set never spans more than a handful of buckets, so    *
+ * keys past 255 just wrap around the ring.  We're searching forward     *
+ * here, so the cost of a step is charged on entering a cell, not on     *
+ * leaving it.  Only the part of the map between the two ends is ever    *
+ * expanded, rather than the whole thing.  On levels with a room graph,  *
+ * even that is too much once the ends are far apart, so the route only  *
+ * goes as far as the graph's next waypoint, a leg at a time.            */
+static inline uint32_t path_heuristic(uint32_t c, uint32_t stride,
+                                      uint32_t tx, uint32_t ty)
+{
+  uint32_t dx, dy;
+
+  dx = abs((int32_t) (c % stride) - (int32_t) tx);
+  dy = abs((int32_t) (c / stride) - (int32_t) ty);
+
+  return dx > dy ? dx : dy;
+}
+
+uint32_t path_to(dungeon *d, pair_t from, pair_t to, uint32_t tunnel,
+                 path_route_t *route)
+{
+  path_context_t *ctx;
+  const int32_t *step_offset;
+  bucket_queue_t *q;
+  terrain_type *map;
+  uint8_t *hardness;
+  route_cost_t *cost;
+  uint8_t *dir;
+  cell_index_t *touched;
+  uint32_t source, target, stride, c, n, i, g, length, num_touched, reached;
+  pair_t via;
+
+  ctx = d->paths.context;
+  step_offset = ctx->step_offset;
+  q = &ctx->queue;
+  cost = ctx->route_cost.data();
+  dir = ctx->route_dir.data();
+  map = &d->map[0][0];
+  hardness = &d->hardness[0][0];
+  stride = dungeon_stride(d);
+  source = cell_index(d, from[dim_x], from[dim_y]);
+  target = cell_index(d, to[dim_x], to[dim_y]);
+
+  route->to[dim_x] = to[dim_x];
+  route->to[dim_y] = to[dim_y];
+  route->at[dim_x] = from[dim_x];
+  route->at[dim_y] = from[dim_y];
+  route->tunnel = tunnel;
+  route->leg = 0;
+  route->generation = d->paths.floor_generation;
+  route->length = route->next = 0;
+  d->paths.routes_planned++;
+
+  if (source == target || !in_graph(map, tunnel, target)) {
+    return 0;
+  }
+
+  via[dim_x] = to[dim_x];
+  via[dim_y] = to[dim_y];
+  if (d->room_graph &&
+      path_heuristic(source, stride, to[dim_x], to[dim_y]) > ROOM_GRAPH_LEG &&
+      room_graph_waypoint(d, from, to, via)) {
+    target = cell_index(d, via[dim_x], via[dim_y]);
+    route->leg = 1;
+    d->paths.routes_by_graph++;
+    /* Legs are walked, even by tunnelers.  The graph measures walks, *
+     * and a tunneler that dug its own way toward one waypoint could  *
+     * find the graph preferring another by the time it got there.    */
+    tunnel = 0;
+  }
+
+  bucket_queue_reset(q);
+  touched = ctx->touched.data();
+  num_touched = 0;
+  cost[source] = 0;
+  touched[num_touched++] = source;
+  bucket_queue_push(q, source,
+                    path_heuristic(source, stride, via[dim_x], via[dim_y]));
+
+  while (q->size && (c = bucket_queue_pop(q)) != target) {
+    for (i = 0; i < PATH_STAY; i++) {
+      n = c + step_offset[i];
+      if (!in_graph(map, tunnel, n)) {
+        continue;
+      }
+      g = cost[c] + (tunnel ? tunnel_movement_cost(hardness[n]) : 1);
+      if (g < cost[n]) {
+        if (cost[n] == PATH_UNREACHED) {
+          touched[num_touched++] = n;
+        }
+        cost[n] = g;
+        dir[n] = i;
+        bucket_queue_push(q, n, (cost[n] + path_heuristic(n, stride,
+                                                           via[dim_x],
+                                                           via[dim_y])));
+      }
     }
-    if ((p[c->pos[dim_y]    ][c->pos[dim_x] + 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y]    ][c->pos[dim_x] + 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y]    ][c->pos[dim_x] + 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y]    ][c->pos[dim_x] + 1].hn);
+  }
+
+  /* Walk back from the end, keeping only the first few steps. */
+  if ((reached = cost[target] != PATH_UNREACHED)) {
+    for (length = 0, c = target; c != source; length++) {
+      c -= step_offset[dir[c]];
     }
-    if ((p[c->pos[dim_y] + 1][c->pos[dim_x] - 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x] - 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x] - 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] + 1][c->pos[dim_x] - 1].hn);
+    route->length = length < PATH_MAX_ROUTE ? length : PATH_MAX_ROUTE;
+    for (i = length, c = target; c != source; c -= step_offset[dir[c]]) {
+      if (--i < PATH_MAX_ROUTE) {
+        route->step[i] = dir[c];
+      }
     }
-    if ((p[c->pos[dim_y] + 1][c->pos[dim_x]    ].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x]    ] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x]    ] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] + 1][c->pos[dim_x]    ].hn);
+  }
+
+  /* Leave everything as it was found, which costs no more than the *
+   * search did, where clearing the whole map would cost as much as *
+   * searching all of it.                                           */
+  for (i = 0; i < num_touched; i++) {
+    cost[touched[i]] = PATH_UNREACHED;
+    q->prev[touched[i]] = PATH_UNQUEUED;
+  }
+
+  return reached;
+}
+
+/* Takes the next step along a cached route, first planning a new one if *
+ * floor has opened up since, the destination has moved, the route has   *
+ * run out, or the monster isn't where the route expected it to be.      *
+ * Rock that's only been chipped is no reason: terrain only ever gets    *
+ * softer, so every route stays open, walking costs don't depend on      *
+ * hardness at all, and a tunneler's route is at most a few dozen steps  *
+ * from being planned again anyway.                                      *
+ * A leg is kept through changes in the terrain and the destination: it  *
+ * only has to get closer, terrain only ever gets softer, and the        *
+ * destination can't have moved far compared to how far off it is.      *
+ * Returns 0, leaving next alone, if there's no way to get there.        */
+uint32_t path_route_step(dungeon *d, path_route_t *route, pair_t from,
+                         pair_t to, uint32_t tunnel, pair_t next)
+{
+  const int8_t *step;
+
+  /* Did the last step get where it was going? */
+  if (route->next < route->length) {
+    step = path_step[route->step[route->next]];
+    if (from[dim_x] == route->at[dim_x] + step[dim_x] &&
+        from[dim_y] == route->at[dim_y] + step[dim_y]) {
+      route->at[dim_x] = from[dim_x];
+      route->at[dim_y] = from[dim_y];
+      route->next++;
     }
-    if ((p[c->pos[dim_y] + 1][c->pos[dim_x] + 1].hn) &&
-        (d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x] + 1] >
-         d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]))) {
-      d->pc_tunnel[c->pos[dim_y] + 1][c->pos[dim_x] + 1] =
-        (d->pc_tunnel[c->pos[dim_y]][c->pos[dim_x]] +
-         tunnel_movement_cost(c->pos[dim_x], c->pos[dim_y]));
-      heap_decrease_key_no_replace(&h,
-                                   p[c->pos[dim_y] + 1][c->pos[dim_x] + 1].hn);
+  }
+
+  if (route->next >= route->length                       ||
+      (!route->leg                                       &&
+       (route->generation != d->paths.floor_generation   ||
+        route->to[dim_x] != to[dim_x]                    ||
+        route->to[dim_y] != to[dim_y]))                  ||
+      route->tunnel != tunnel                            ||
+      route->at[dim_x] != from[dim_x]                    ||
+      route->at[dim_y] != from[dim_y]) {
+    if (!path_to(d, from, to, tunnel, route)) {
+      return 0;
     }
+  } else {
+    d->paths.routes_followed++;
   }
-  heap_delete(&h);
+
+  step = path_step[route->step[route->next]];
+  next[dim_x] = from[dim_x] + step[dim_x];
+  next[dim_y] = from[dim_y] + step[dim_y];
+
+  return 1;
+}
+
+void path_report(dungeon *d, FILE *f)
+{
+  fprintf(f, "Distance maps: walking %u built, %u repaired, %u skipped; "
+          "tunneling %u built, %u repaired, %u skipped.\n",
+          d->paths.rebuilds[path_walk], d->paths.repairs[path_walk],
+          d->paths.skipped[path_walk], d->paths.rebuilds[path_tunnel],
+          d->paths.repairs[path_tunnel], d->paths.skipped[path_tunnel]);
+  fprintf(f, "Routes: %u planned (%u a leg at a time), "
+          "%u steps taken from cache.\n", d->paths.routes_planned,
+          d->paths.routes_by_graph, d->paths.routes_followed);
 }
@@ -1,11 +1,97 @@
 #ifndef PATH_H
 # define PATH_H
 
+# include <stdio.h>
+# include <stdint.h>
+
+# include "dims.h"
+
 # define HARDNESS_PER_TURN 85
+/* Maximum number of terrain changes the distance maps can absorb *
+ * between updates before repair gives up and rebuilds instead.   */
+# define PATH_MAX_DIRTY    32
+/* Number of steps of a route that a monster remembers. */
+# define PATH_MAX_ROUTE    32
+
+/* pc_downhill holds the best step toward the PC out of each cell, the *
+ * walking step in the low nibble and the tunneling step in the high   *
+ * nibble, as an index into path_step.                                 */
+# define PATH_STAY 8
+# define path_walk_dir(d, pos)                           \
+  ((d)->pc_downhill[(pos)[dim_y]][(pos)[dim_x]] & 0xf)
+# define path_tunnel_dir(d, pos)                         \
+  ((d)->pc_downhill[(pos)[dim_y]][(pos)[dim_x]] >> 4)
 
 class dungeon;
 
+/* Scratch buffers for the computations; opaque outside of path.cpp. */
+typedef struct path_context path_context_t;
+
+typedef enum path_map {
+  path_walk,
+  path_tunnel,
+  num_path_maps
+} path_map_t;
+
+/* Enough history to repair the distance maps instead of rebuilding  *
+ * them: where the PC was when each map was last brought up to date, *
+ * and the last few cells whose terrain has changed.  Changes are    *
+ * numbered; dirty[i] is change dirty_base + i + 1, and each map     *
+ * remembers the last change it has seen.  Routes are stamped with   *
+ * floor_generation instead, which counts only the changes that      *
+ * opened up floor.  The counters are for profiling.  The context is *
+ * scratch space for the computations; every dungeon has its own, so *
+ * that dungeons can be pathed concurrently.                         */
+typedef struct path_state {
+  path_context_t *context;
+  pair_t source[num_path_maps];
+  uint8_t valid[num_path_maps];
+  uint8_t stale[num_path_maps];
+  uint8_t used[num_path_maps];
+  uint32_t generation;
+  uint32_t floor_generation;
+  uint32_t map_generation[num_path_maps];
+  uint32_t dirty_base;
+  uint32_t num_dirty;
+  pair_t dirty[PATH_MAX_DIRTY];
+  uint32_t rebuilds[num_path_maps];
+  uint32_t repairs[num_path_maps];
+  uint32_t skipped[num_path_maps];
+  uint32_t routes_planned;
+  uint32_t routes_followed;
+  uint32_t routes_by_graph;
+} path_state_t;
+
+/* A monster's planned route to some cell: the first few steps of it,  *
+ * anyway, as indices into path_step, along with what it was planned   *
+ * for, so that it can tell when it needs to be planned again.  A leg  *
+ * is a route only as far as a waypoint on the way to the cell.        */
+typedef struct path_route {
+  pair_t to;
+  pair_t at;
+  uint32_t generation;
+  uint8_t tunnel;
+  uint8_t leg;
+  uint8_t length;
+  uint8_t next;
+  uint8_t step[PATH_MAX_ROUTE];
+} path_route_t;
+
+extern const int8_t path_step[PATH_STAY + 1][num_dims];
+
+void compute_pc_distance_fields(dungeon *d);
 void dijkstra(dungeon *d);
 void dijkstra_tunnel(dungeon *d);
+void path_ensure(dungeon *d, path_map_t m);
+void path_init(dungeon *d);
+void path_delete(dungeon *d);
+void path_invalidate(dungeon *d);
+void path_note_pc_moved(dungeon *d);
+void path_note_terrain_change(dungeon *d, pair_t pos);
+uint32_t path_to(dungeon *d, pair_t from, pair_t to, uint32_t tunnel,
+                 path_route_t *route);
+uint32_t path_route_step(dungeon *d, path_route_t *route, pair_t from,
+                         pair_t to, uint32_t tunnel, pair_t next);
+void path_report(dungeon *d, FILE *f);
 
 #endif
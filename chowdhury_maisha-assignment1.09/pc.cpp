@@ -26,7 +26,7 @@ const char *equip_inv_name[num_equip_inv] = {
     "lh ring",
     "rh ring"};
 
-pc::pc()
+pc::pc() : known_terrain(DUNGEON_X, DUNGEON_Y), visible(DUNGEON_X, DUNGEON_Y)
 {
   uint32_t i;
 
@@ -74,10 +74,12 @@ uint32_t pc_is_alive(dungeon *d)
 
 void place_pc(dungeon *d)
 {
-  d->PC->position[dim_y] = rand_range(d->rooms->position[dim_y],
+  d->PC->position[dim_y] = rand_range(d->rng + rng_level,
+                                      d->rooms->position[dim_y],
                                      (d->rooms->position[dim_y] +
                                       d->rooms->size[dim_y] - 1));
-  d->PC->position[dim_x] = rand_range(d->rooms->position[dim_x],
+  d->PC->position[dim_x] = rand_range(d->rng + rng_level,
+                                      d->rooms->position[dim_x],
                                      (d->rooms->position[dim_x] +
                                       d->rooms->size[dim_x] - 1));
 
@@ -90,6 +92,8 @@ void config_pc(dungeon *d)
   static dice pc_dice(0, 1, 4);
   
   d->PC = new pc;
+  d->PC->known_terrain.resize(dungeon_x(d), dungeon_y(d));
+  d->PC->visible.resize(dungeon_x(d), dungeon_y(d));
 
   d->PC->symbol = '@';
 
@@ -105,8 +109,7 @@ void config_pc(dungeon *d)
 
   d->character_map[d->PC->position[dim_y]][d->PC->position[dim_x]] = d->PC;
 
-  dijkstra(d);
-  dijkstra_tunnel(d);
+  path_invalidate(d);
 }
 
 uint32_t pc_next_pos(dungeon *d, pair_t dir)
@@ -149,20 +152,22 @@ uint32_t pc_next_pos(dungeon *d, pair_t dir)
     if (count) {
       count++;
     }
-    if (!against_wall(d, d->PC) && ((rand() & 0x111) == 0x111)) {
-      dir[dim_x] = (rand() % 3) - 1;
-      dir[dim_y] = (rand() % 3) - 1;
+    if (!against_wall(d, d->PC) &&
+        ((rng_next(d->rng + rng_pc) & 0x111) == 0x111)) {
+      dir[dim_x] = rng_below(d->rng + rng_pc, 3) - 1;
+      dir[dim_y] = rng_below(d->rng + rng_pc, 3) - 1;
     } else {
       dir_nearest_wall(d, d->PC, dir);
     }
   }else {
     /* And after we've been there, let's head toward the center of the map. */
-    if (!against_wall(d, d->PC) && ((rand() & 0x111) == 0x111)) {
-      dir[dim_x] = (rand() % 3) - 1;
-      dir[dim_y] = (rand() % 3) - 1;
+    if (!against_wall(d, d->PC) &&
+        ((rng_next(d->rng + rng_pc) & 0x111) == 0x111)) {
+      dir[dim_x] = rng_below(d->rng + rng_pc, 3) - 1;
+      dir[dim_y] = rng_below(d->rng + rng_pc, 3) - 1;
     } else {
-      dir[dim_x] = ((d->PC->position[dim_x] > DUNGEON_X / 2) ? -1 : 1);
-      dir[dim_y] = ((d->PC->position[dim_y] > DUNGEON_Y / 2) ? -1 : 1);
+      dir[dim_x] = ((d->PC->position[dim_x] > dungeon_x(d) / 2) ? -1 : 1);
+      dir[dim_y] = ((d->PC->position[dim_y] > dungeon_y(d) / 2) ? -1 : 1);
     }
   }
 
@@ -207,21 +212,6 @@ uint32_t pc_next_pos(dungeon *d, pair_t dir)
   return 0;
 }
 
-uint32_t pc_in_room(dungeon *d, uint32_t room)
-{
-  if ((room < d->num_rooms)                                     &&
-      (d->PC->position[dim_x] >= d->rooms[room].position[dim_x]) &&
-      (d->PC->position[dim_x] < (d->rooms[room].position[dim_x] +
-                                d->rooms[room].size[dim_x]))    &&
-      (d->PC->position[dim_y] >= d->rooms[room].position[dim_y]) &&
-      (d->PC->position[dim_y] < (d->rooms[room].position[dim_y] +
-                                d->rooms[room].size[dim_y]))) {
-    return 1;
-  }
-
-  return 0;
-}
-
 void pc_learn_terrain(pc *p, pair_t pos, terrain_type ter)
 {
   p->known_terrain[pos[dim_y]][pos[dim_x]] = ter;
@@ -230,18 +220,13 @@ void pc_learn_terrain(pc *p, pair_t pos, terrain_type ter)
 
 void pc_reset_visibility(pc *p)
 {
-  uint32_t y, x;
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      p->visible[y][x] = 0;
-    }
-  }
+  p->visible.fill(0);
 }
 
 terrain_type pc_learned_terrain(pc *p, int16_t y, int16_t x)
 {
-  if (y < 0 || y >= DUNGEON_Y || x < 0 || x >= DUNGEON_X) {
+  if (y < 0 || y >= p->known_terrain.height() ||
+      x < 0 || x >= p->known_terrain.width()) {
     io_queue_message("Invalid value to %s: %d, %d", __FUNCTION__, y, x);
   }
 
@@ -250,14 +235,8 @@ terrain_type pc_learned_terrain(pc *p, int16_t y, int16_t x)
 
 void pc_init_known_terrain(pc *p)
 {
-  uint32_t y, x;
-
-  for (y = 0; y < DUNGEON_Y; y++) {
-    for (x = 0; x < DUNGEON_X; x++) {
-      p->known_terrain[y][x] = ter_unknown;
-      p->visible[y][x] = 0;
-    }
-  }
+  p->known_terrain.fill(ter_unknown);
+  p->visible.fill(0);
 }
 
 void pc_observe_terrain(pc *p, dungeon *d)
@@ -270,16 +249,16 @@ void pc_observe_terrain(pc *p, dungeon *d)
     y_min = 0;
   }
   y_max = p->position[dim_y] + PC_VISUAL_RANGE;
-  if (y_max > DUNGEON_Y - 1) {
-    y_max = DUNGEON_Y - 1;
+  if (y_max > dungeon_y(d) - 1) {
+    y_max = dungeon_y(d) - 1;
   }
   x_min = p->position[dim_x] - PC_VISUAL_RANGE;
   if (x_min < 0) {
     x_min = 0;
   }
   x_max = p->position[dim_x] + PC_VISUAL_RANGE;
-  if (x_max > DUNGEON_X - 1) {
-    x_max = DUNGEON_X - 1;
+  if (x_max > dungeon_x(d) - 1) {
+    x_max = dungeon_x(d) - 1;
   }
 
   for (where[dim_y] = y_min; where[dim_y] <= y_max; where[dim_y]++) {
@@ -33,8 +33,8 @@ private:
   object *fetch_from_tile(dungeon *d, pair_t pos);
 
 public:
-  terrain_type known_terrain[DUNGEON_Y][DUNGEON_X];
-  unsigned char visible[DUNGEON_Y][DUNGEON_X];
+  dungeon_grid<terrain_type> known_terrain;
+  dungeon_grid<unsigned char> visible;
   object *eq[num_equip_inv];
   object *in[INVENTORY_SIZE];
 
@@ -55,7 +55,6 @@ uint32_t pc_is_alive(dungeon *d);
 void config_pc(dungeon *d);
 uint32_t pc_next_pos(dungeon *d, pair_t dir);
 void place_pc(dungeon *d);
-uint32_t pc_in_room(dungeon *d, uint32_t room);
 void pc_learn_terrain(pc *p, pair_t pos, terrain_type ter);
 terrain_type pc_learned_terrain(pc *p, int16_t y, int16_t x);
 void pc_init_known_terrain(pc *p);
@@ -0,0 +1,370 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <endian.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "dungeon.h"
+#include "utils.h"
+
+/* Generates levels in bulk, without a game around them: no terminal,  *
+ * no descriptions, no PC, monsters or objects.  Level i is seeded     *
+ * with first_seed + i, exactly as rlg327 --rand would seed it, and    *
+ * the levels are either packed into a single archive or only counted. *
+ *                                                                     *
+ * An archive is DUNGEON_PACK_SEMANTIC, then the pack version, the     *
+ * first seed and the number of levels, each as a big-endian 32-bit    *
+ * integer, then every level in seed order, each exactly as            *
+ * write_dungeon() would save it, with the PC where place_pc() would   *
+ * have started it.  Each record carries its own size, so a reader     *
+ * can skip to any level without parsing the ones before it.           */
+
+/* Levels are handed out to threads this many at a time.  Each thread *
+ * saves its batch to memory and waits its turn to append it to the    *
+ * archive, so the archive comes out in seed order whatever the number *
+ * of threads.                                                         */
+#define GEN_BATCH 64
+
+typedef struct gen_range {
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+} gen_range_t;
+
+typedef enum gen_measure {
+  gen_rooms,
+  gen_corridor_cells,
+  gen_up_stairs,
+  gen_down_stairs,
+  gen_ns,
+  num_gen_measures
+} gen_measure_t;
+
+typedef struct gen_job {
+  uint32_t first_seed;
+  uint32_t count;
+  uint32_t threads;
+  FILE *out;
+  pthread_mutex_t lock;
+  pthread_cond_t turn;
+  uint32_t next_batch;
+  uint32_t next_to_write;
+  gen_range_t tally[num_gen_measures];
+  gen_stats_t stats;
+} gen_job_t;
+
+void usage(char *name)
+{
+  fprintf(stderr,
+          "Usage: %s [-r|--rand <first seed>] [-c|--count <levels>]\n"
+          "          [-j|--jobs <threads>]\n"
+          "          (-o|--output <archive> | -s|--stats)\n",
+          name);
+
+  exit(-1);
+}
+
+static void gen_range_init(gen_range_t *r)
+{
+  r->sum = r->max = 0;
+  r->min = UINT64_MAX;
+}
+
+static void gen_range_add(gen_range_t *r, uint64_t v)
+{
+  r->sum += v;
+  if (v < r->min) {
+    r->min = v;
+  }
+  if (v > r->max) {
+    r->max = v;
+  }
+}
+
+static void gen_range_merge(gen_range_t *r, const gen_range_t *with)
+{
+  r->sum += with->sum;
+  if (with->min < r->min) {
+    r->min = with->min;
+  }
+  if (with->max > r->max) {
+    r->max = with->max;
+  }
+}
+
+static uint32_t count_corridor_cells(dungeon *d)
+{
+  int32_t x, y;
+  uint32_t n;
+
+  for (n = 0, y = 1; y < dungeon_y(d) - 1; y++) {
+    for (x = 1; x < dungeon_x(d) - 1; x++) {
+      if (mapxy(x, y) == ter_floor_hall) {
+        n++;
+      }
+    }
+  }
+
+  return n;
+}
+
+static void gen_level(dungeon *d, uint32_t seed, gen_range_t *tally,
+                      FILE *out)
+{
+  uint64_t ns;
+  pair_t pc;
+
+  ns = d->gen_stats.ns;
+  seed_dungeon(d, seed);
+  init_dungeon(d);
+  gen_dungeon(d);
+
+  gen_range_add(tally + gen_ns, d->gen_stats.ns - ns);
+  gen_range_add(tally + gen_rooms, d->num_rooms);
+  gen_range_add(tally + gen_corridor_cells, count_corridor_cells(d));
+  gen_range_add(tally + gen_up_stairs, count_up_stairs(d));
+  gen_range_add(tally + gen_down_stairs, count_down_stairs(d));
+
+  if (out) {
+    /* The same draws, in the same order, as place_pc(). */
+    pc[dim_y] = rand_range(d->rng + rng_level, d->rooms->position[dim_y],
+                           (d->rooms->position[dim_y] +
+                            d->rooms->size[dim_y] - 1));
+    pc[dim_x] = rand_range(d->rng + rng_level, d->rooms->position[dim_x],
+                           (d->rooms->position[dim_x] +
+                            d->rooms->size[dim_x] - 1));
+    write_dungeon_record(d, pc, out);
+  }
+
+  delete_dungeon(d);
+}
+
+static void *gen_worker(void *v)
+{
+  gen_job_t *job = (gen_job_t *) v;
+  gen_range_t tally[num_gen_measures];
+  dungeon *d;
+  uint32_t batch, first, last, i;
+  char *buf;
+  size_t len;
+  FILE *mem;
+
+  d = new dungeon;
+  for (i = 0; i < num_gen_measures; i++) {
+    gen_range_init(tally + i);
+  }
+
+  for (;;) {
+    pthread_mutex_lock(&job->lock);
+    batch = job->next_batch++;
+    pthread_mutex_unlock(&job->lock);
+
+    if ((uint64_t) batch * GEN_BATCH >= job->count) {
+      break;
+    }
+    first = batch * GEN_BATCH;
+    last = (job->count - first < GEN_BATCH ? job->count :
+                                             first + GEN_BATCH);
+
+    mem = NULL;
+    if (job->out && !(mem = open_memstream(&buf, &len))) {
+      perror("open_memstream");
+      exit(-1);
+    }
+    for (i = first; i < last; i++) {
+      gen_level(d, job->first_seed + i, tally, mem);
+    }
+
+    if (mem) {
+      fclose(mem);
+      pthread_mutex_lock(&job->lock);
+      while (job->next_to_write != batch) {
+        pthread_cond_wait(&job->turn, &job->lock);
+      }
+      fwrite(buf, 1, len, job->out);
+      job->next_to_write++;
+      pthread_cond_broadcast(&job->turn);
+      pthread_mutex_unlock(&job->lock);
+      free(buf);
+    }
+  }
+
+  pthread_mutex_lock(&job->lock);
+  for (i = 0; i < num_gen_measures; i++) {
+    gen_range_merge(job->tally + i, tally + i);
+  }
+  job->stats.levels += d->gen_stats.levels;
+  job->stats.room_attempts += d->gen_stats.room_attempts;
+  job->stats.room_restarts += d->gen_stats.room_restarts;
+  job->stats.corridor_cells += d->gen_stats.corridor_cells;
+  pthread_mutex_unlock(&job->lock);
+
+  delete d;
+
+  return NULL;
+}
+
+static void gen_report_job(gen_job_t *job, FILE *o, double seconds)
+{
+  static const char *measure_name[num_gen_measures] = {
+    "rooms",
+    "corridor cells",
+    "up stairs",
+    "down stairs",
+    "generation ms"
+  };
+  double scale;
+  uint32_t i;
+
+  fprintf(o, "%u levels (seeds %u to %u) on %u threads in %.3f seconds: "
+          "%.0f levels/second.\n", job->count, job->first_seed,
+          job->first_seed + job->count - 1, job->threads, seconds,
+          seconds > 0 ? job->count / seconds : 0.0);
+  fprintf(o, "  %-16s %10s %10s %10s\n", "", "mean", "min", "max");
+  for (i = 0; i < num_gen_measures; i++) {
+    scale = i == gen_ns ? 1e6 : 1;
+    fprintf(o, "  %-16s %10.3f %10.3f %10.3f\n", measure_name[i],
+            job->tally[i].sum / scale / job->count,
+            job->tally[i].min / scale, job->tally[i].max / scale);
+  }
+  fprintf(o, "Room placement: %.1f attempts per level, %u restarts.  "
+          "Corridors: %.0f cells searched per level.\n",
+          (double) job->stats.room_attempts / job->count,
+          job->stats.room_restarts,
+          (double) job->stats.corridor_cells / job->count);
+}
+
+int main(int argc, char *argv[])
+{
+  gen_job_t job;
+  struct timeval tv, start, end;
+  pthread_t *threads;
+  uint32_t do_seed, stats_only, long_arg, be32;
+  char *out_file;
+  double seconds;
+  int32_t i;
+
+  memset(&job, 0, sizeof (job));
+  job.count = 1;
+  job.threads = sysconf(_SC_NPROCESSORS_ONLN);
+  do_seed = 1;
+  stats_only = 0;
+  out_file = NULL;
+
+  for (i = 1, long_arg = 0; i < argc; i++, long_arg = 0) {
+    if (argv[i][0] != '-') {
+      usage(argv[0]);
+    }
+    if (argv[i][1] == '-') {
+      argv[i]++;
+      long_arg = 1;
+    }
+    switch (argv[i][1]) {
+    case 'r':
+      if ((!long_arg && argv[i][2]) ||
+          (long_arg && strcmp(argv[i], "-rand")) ||
+          argc < ++i + 1 /* No more arguments */ ||
+          !sscanf(argv[i], "%u", &job.first_seed)) {
+        usage(argv[0]);
+      }
+      do_seed = 0;
+      break;
+    case 'c':
+      if ((!long_arg && argv[i][2]) ||
+          (long_arg && strcmp(argv[i], "-count")) ||
+          argc < ++i + 1 /* No more arguments */ ||
+          !sscanf(argv[i], "%u", &job.count) || !job.count) {
+        usage(argv[0]);
+      }
+      break;
+    case 'j':
+      if ((!long_arg && argv[i][2]) ||
+          (long_arg && strcmp(argv[i], "-jobs")) ||
+          argc < ++i + 1 /* No more arguments */ ||
+          !sscanf(argv[i], "%u", &job.threads) || !job.threads) {
+        usage(argv[0]);
+      }
+      break;
+    case 'o':
+      if ((!long_arg && argv[i][2]) ||
+          (long_arg && strcmp(argv[i], "-output")) ||
+          argc < ++i + 1 /* No more arguments */) {
+        usage(argv[0]);
+      }
+      out_file = argv[i];
+      break;
+    case 's':
+      if ((!long_arg && argv[i][2]) ||
+          (long_arg && strcmp(argv[i], "-stats"))) {
+        usage(argv[0]);
+      }
+      stats_only = 1;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+
+  if (!out_file == !stats_only) {
+    usage(argv[0]);
+  }
+
+  if (do_seed) {
+    gettimeofday(&tv, NULL);
+    job.first_seed = (tv.tv_usec ^ (tv.tv_sec << 20)) & 0xffffffff;
+  }
+
+  if (out_file) {
+    if (!(job.out = fopen(out_file, "w"))) {
+      perror(out_file);
+      exit(-1);
+    }
+    fwrite(DUNGEON_PACK_SEMANTIC, 1, sizeof (DUNGEON_PACK_SEMANTIC) - 1,
+           job.out);
+    be32 = htobe32(DUNGEON_PACK_VERSION);
+    fwrite(&be32, sizeof (be32), 1, job.out);
+    be32 = htobe32(job.first_seed);
+    fwrite(&be32, sizeof (be32), 1, job.out);
+    be32 = htobe32(job.count);
+    fwrite(&be32, sizeof (be32), 1, job.out);
+  }
+
+  for (i = 0; i < num_gen_measures; i++) {
+    gen_range_init(job.tally + i);
+  }
+  pthread_mutex_init(&job.lock, NULL);
+  pthread_cond_init(&job.turn, NULL);
+  threads = (pthread_t *) malloc(job.threads * sizeof (*threads));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < (int32_t) job.threads; i++) {
+    if (pthread_create(threads + i, NULL, gen_worker, &job)) {
+      fprintf(stderr, "Failed to start generator thread %d.\n", i);
+      exit(-1);
+    }
+  }
+  for (i = 0; i < (int32_t) job.threads; i++) {
+    pthread_join(threads[i], NULL);
+  }
+  gettimeofday(&end, NULL);
+  seconds = ((end.tv_sec - start.tv_sec) +
+             (end.tv_usec - start.tv_usec) / 1e6);
+
+  gen_report_job(&job, stdout, seconds);
+
+  if (job.out) {
+    if (ferror(job.out) | fclose(job.out)) {
+      fprintf(stderr, "Failed writing %s.\n", out_file);
+      exit(-1);
+    }
+    printf("Wrote %s.\n", out_file);
+  }
+
+  pthread_cond_destroy(&job.turn);
+  pthread_mutex_destroy(&job.lock);
+  free(threads);
+
+  return 0;
+}
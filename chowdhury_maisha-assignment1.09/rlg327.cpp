@@ -11,6 +11,9 @@
 #include "utils.h"
 #include "io.h"
 #include "object.h"
+#include "autopilot.h"
+#include "farm.h"
+#include "level.h"
 
 const char *victory =
   "\n                                       o\n"
@@ -69,7 +72,12 @@ void usage(char *name)
   fprintf(stderr,
           "Usage: %s [-r|--rand <seed>] [-l|--load [<file>]]\n"
           "          [-s|--save [<file>]] [-i|--image <pgm file>]\n"
-          "          [-n|--nummon <count>] [-o|--objcount <oject count>]\n",
+          "          [-n|--nummon <count>] [-o|--objcount <oject count>]\n"
+          "          [-h|--headless] [-t|--turns <count>]\n"
+          "          [-a|--autopilot random|explore|hunt|descend]\n"
+          "          [-f|--farm <games>] [-j|--jobs <threads>]\n"
+          "          [-m|--memory <kilobytes of frozen floors>]\n"
+          "          [-d|--dimensions <width>x<height>]\n",
           name);
 
   exit(-1);
@@ -79,21 +87,30 @@ int main(int argc, char *argv[])
 {
   dungeon d;
   time_t seed;
-  struct timeval tv;
+  struct timeval tv, start, end;
   int32_t i;
   uint32_t do_load, do_save, do_seed, do_image, do_save_seed, do_save_image;
+  uint32_t headless, max_turns;
+  farm_config_t farm;
   uint32_t long_arg;
   char *save_file;
   char *load_file;
   char *pgm_file;
+  pair_t dims;
   
   /* Default behavior: Seed with the time, generate a new dungeon, *
    * and don't write to disk.                                      */
   do_load = do_save = do_image = do_save_seed = do_save_image = 0;
+  headless = max_turns = 0;
+  farm.games = 0;
+  farm.threads = sysconf(_SC_NPROCESSORS_ONLN);
   do_seed = 1;
   save_file = load_file = NULL;
   d.max_monsters = MAX_MONSTERS;
   d.max_objects = MAX_OBJECTS;
+  d.level_budget = LEVEL_MEMORY_BUDGET;
+  dims[dim_x] = DUNGEON_X;
+  dims[dim_y] = DUNGEON_Y;
 
   /* The project spec requires '--load' and '--save'.  It's common  *
    * to have short and long forms of most switches (assuming you    *
@@ -188,6 +205,76 @@ int main(int argc, char *argv[])
             usage(argv[0]);
           }
           break;
+        case 'h':
+          /* No terminal; the PC plays itself (at random, unless told *
+           * otherwise), and we report on how fast the engine ran.     */
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-headless"))) {
+            usage(argv[0]);
+          }
+          headless = 1;
+          break;
+        case 'a':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-autopilot")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !(d.controller = autopilot_find(argv[i]))) {
+            usage(argv[0]);
+          }
+          break;
+        case 't':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-turns")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &max_turns)) {
+            usage(argv[0]);
+          }
+          break;
+        case 'f':
+          /* Plays this many headless games, starting with the seed and *
+           * counting up, and reports on all of them together.          */
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-farm")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &farm.games) || !farm.games) {
+            usage(argv[0]);
+          }
+          headless = 1;
+          break;
+        case 'j':
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-jobs")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%u", &farm.threads) || !farm.threads) {
+            usage(argv[0]);
+          }
+          break;
+        case 'm':
+          /* Floors left behind past this many kilobytes go to disk. */
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-memory")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              !sscanf(argv[i], "%zu", &d.level_budget)) {
+            usage(argv[0]);
+          }
+          d.level_budget *= 1024;
+          break;
+        case 'd':
+          /* Levels are never smaller than the screen. */
+          if ((!long_arg && argv[i][2]) ||
+              (long_arg && strcmp(argv[i], "-dimensions")) ||
+              argc < ++i + 1 /* No more arguments */ ||
+              sscanf(argv[i], "%hdx%hd", &dims[dim_x], &dims[dim_y]) != 2 ||
+              dims[dim_x] < DUNGEON_X || dims[dim_y] < DUNGEON_Y) {
+            usage(argv[0]);
+          }
+          if (!DUNGEON_GRID_DYNAMIC &&
+              (dims[dim_x] != DUNGEON_X || dims[dim_y] != DUNGEON_Y)) {
+            fprintf(stderr, "This build only makes %dx%d levels; "
+                    "rlg327-big makes others.\n", DUNGEON_X, DUNGEON_Y);
+            exit(-1);
+          }
+          break;
         default:
           usage(argv[0]);
         }
@@ -204,10 +291,29 @@ int main(int argc, char *argv[])
     seed = (tv.tv_usec ^ (tv.tv_sec << 20)) & 0xffffffff;
   }
 
-  srand(seed);
+  seed_dungeon(&d, seed);
+  size_dungeon(&d, dims[dim_x], dims[dim_y]);
 
   parse_descriptions(&d);
-  io_init_terminal();
+  if (headless) {
+    io_init_headless();
+    d.stats.enabled = 1;
+    if (!d.controller) {
+      d.controller = &autopilot_random;
+    }
+  } else {
+    io_init_terminal();
+  }
+
+  if (farm.games) {
+    farm.first_seed = seed;
+    farm.max_turns = max_turns;
+    farm_run(&d, &farm, stdout);
+    destroy_descriptions(&d);
+
+    return 0;
+  }
+
   init_dungeon(&d);
 
   if (do_load) {
@@ -222,18 +328,24 @@ int main(int argc, char *argv[])
   config_pc(&d);
   gen_monsters(&d);
   gen_objects(&d);
+  pregen_level(&d);
   pc_observe_terrain(d.PC, &d);
 
   io_display(&d);
   if (!do_load && !do_image) {
     io_queue_message("Seed is %u.", seed);
   }
-  while (pc_is_alive(&d) && dungeon_has_npcs(&d) && !d.quit) {
+  gettimeofday(&start, NULL);
+  while (pc_is_alive(&d) && dungeon_has_npcs(&d) && !d.quit &&
+         (!max_turns || d.stats.pc_turns < max_turns)) {
     do_moves(&d);
   }
+  gettimeofday(&end, NULL);
   io_display(&d);
 
-  io_reset_terminal();
+  if (!headless) {
+    io_reset_terminal();
+  }
 
   if (do_save) {
     if (do_save_seed) {
@@ -259,7 +371,18 @@ int main(int argc, char *argv[])
     }
   }
 
-  printf("%s", pc_is_alive(&d) ? victory : tombstone);
+  if (headless) {
+    printf("Seed %ld: %s.\n", seed,
+           !pc_is_alive(&d) ? "the PC died" :
+           !dungeon_has_npcs(&d) ? "the PC won" : "out of turns");
+    move_report(&d, stdout, ((end.tv_sec - start.tv_sec) +
+                             (end.tv_usec - start.tv_usec) / 1e6));
+    path_report(&d, stderr);
+    gen_report(&d, stderr);
+    level_report(&d, stderr);
+  } else {
+    printf("%s", pc_is_alive(&d) ? victory : tombstone);
+  }
   printf("You defended your life in the face of %u deadly beasts.\n"
          "You avenged the cruel and untimely murders of %u "
          "peaceful dungeon residents.\n",
@@ -272,6 +395,7 @@ int main(int argc, char *argv[])
     character_delete(d.PC);
   }
 
+  level_store_delete(&d);
   delete_dungeon(&d);
   destroy_descriptions(&d);
 
@@ -0,0 +1,73 @@
+#ifndef RNG_H
+# define RNG_H
+
+# include <stdint.h>
+
+/* xoshiro128** (Blackman and Vigna): 128 bits of state, a handful of  *
+ * shifts and xors per number, and no locks, since every generator is  *
+ * a plain value that belongs to whoever holds it.  Each dungeon owns  *
+ * several, one per subsystem, split off a single seed, so that the    *
+ * monsters' choices don't shift when, say, the level generator draws  *
+ * one more number than it used to.                                    */
+typedef struct rng {
+  uint32_t s[4];
+} rng_t;
+
+static inline uint32_t rng_rotl(uint32_t x, uint32_t k)
+{
+  return (x << k) | (x >> (32 - k));
+}
+
+static inline uint32_t rng_next(rng_t *r)
+{
+  uint32_t result, t;
+
+  result = rng_rotl(r->s[1] * 5, 7) * 9;
+  t = r->s[1] << 9;
+  r->s[2] ^= r->s[0];
+  r->s[3] ^= r->s[1];
+  r->s[1] ^= r->s[2];
+  r->s[0] ^= r->s[3];
+  r->s[2] ^= t;
+  r->s[3] = rng_rotl(r->s[3], 11);
+
+  return result;
+}
+
+/* Returns a random integer in [0, n).  Lemire's multiply-and-shift, *
+ * rather than a modulus; the bias is the same (negligible) and it   *
+ * saves a divide.                                                   */
+static inline uint32_t rng_below(rng_t *r, uint32_t n)
+{
+  return ((uint64_t) rng_next(r) * n) >> 32;
+}
+
+/* Expands seed through splitmix64, which is how the xoshiro authors *
+ * recommend filling the state.  Every seed gives a good state.      */
+static inline void rng_seed(rng_t *r, uint64_t seed)
+{
+  uint64_t z;
+  uint32_t i;
+
+  for (i = 0; i < 4; i += 2) {
+    z = (seed += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    z ^= z >> 31;
+    r->s[i] = z;
+    r->s[i + 1] = z >> 32;
+  }
+}
+
+/* Seeds child from the next 64 bits of parent, giving an independent *
+ * stream that is still fully determined by parent's seed.            */
+static inline void rng_split(rng_t *parent, rng_t *child)
+{
+  uint64_t seed;
+
+  seed = rng_next(parent);
+  seed = (seed << 32) | rng_next(parent);
+  rng_seed(child, seed);
+}
+
+#endif
@@ -0,0 +1,443 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "roomgraph.h"
+#include "dungeon.h"
+#include "utils.h"
+
+#define ROOM_GRAPH_NONE UINT32_MAX
+/* How far a route's ends are searched for portals, cell by cell.  Far *
+ * enough to get out of any room, or along most corridors; an end that *
+ * reaches none is routed the old way.                                 */
+#define ROOM_GRAPH_REACH (4 * DUNGEON_X)
+
+typedef struct room_portal {
+  pair_t pos;
+  /* Its edges run from edges[first] up to the next portal's first. */
+  uint32_t first;
+} room_portal_t;
+
+typedef struct room_edge {
+  uint32_t to;
+  uint32_t cost;
+} room_edge_t;
+
+/* What one search has found out about one portal.  A node belongs to a *
+ * search only if its query number says so, and is the route's end if  *
+ * its goal number says so.  slot is where it is in the queue, if it's  *
+ * in it.                                                               */
+typedef struct room_graph_node {
+  uint32_t slot;
+  uint32_t index;
+  uint32_t query;
+  uint32_t cost;
+  uint32_t key;
+  uint32_t from;
+  uint32_t goal;
+  uint32_t goal_cost;
+} room_graph_node_t;
+
+typedef struct room_graph_found {
+  uint32_t portal;
+  uint32_t cost;
+} room_graph_found_t;
+
+/* portal holds one more than the index of the portal in each cell, or *
+ * zero.  The rest is scratch space for searches.  The queue is a      *
+ * binary heap of node indices, as the corridor router's is; there are *
+ * far too many decreased keys for a Fibonacci heap to pay.            */
+struct room_graph {
+  uint32_t num_portals;
+  room_portal_t *portals;
+  room_edge_t *edges;
+  room_graph_node_t *nodes;
+  uint32_t *queue;
+  uint32_t size;
+  room_graph_found_t *found;
+  dungeon_grid<uint32_t> portal;
+  dungeon_grid<uint32_t> mark;
+  dungeon_grid<uint16_t> dist;
+  cell_index_t *fifo;
+  int32_t neighbor[8];
+  uint32_t flood;
+  uint32_t query;
+};
+
+/* Breadth-first out of c over open floor, out to reach steps, noting   *
+ * every portal it comes to in found, but going no farther through it.  *
+ * Given rooms, it stays out of them.  c itself may be anything but     *
+ * immutable rock, and isn't noted.  If it comes to stop, it stops, and *
+ * returns with *stop_cost set; otherwise *stop_cost is left alone.     *
+ * Returns how many portals it found.                                   */
+static uint32_t room_graph_flood(dungeon *d, room_graph_t *g, uint32_t c,
+                                 uint32_t reach, const room_id_t *rooms,
+                                 uint32_t stop, uint32_t *stop_cost)
+{
+  const terrain_type *map;
+  uint32_t *mark, *portal;
+  uint16_t *dist;
+  uint32_t head, tail, i, n, num_found;
+
+  map = d->map.data();
+  mark = g->mark.data();
+  portal = g->portal.data();
+  dist = g->dist.data();
+
+  g->flood++;
+  mark[c] = g->flood;
+  dist[c] = 0;
+  g->fifo[0] = c;
+  head = 0;
+  tail = 1;
+  num_found = 0;
+
+  while (head != tail) {
+    c = g->fifo[head++];
+    if (dist[c] >= reach) {
+      continue;
+    }
+    for (i = 0; i < 8; i++) {
+      n = c + g->neighbor[i];
+      if (mark[n] == g->flood || map[n] < ter_floor || (rooms && rooms[n])) {
+        continue;
+      }
+      mark[n] = g->flood;
+      dist[n] = dist[c] + 1;
+      if (n == stop) {
+        *stop_cost = dist[n];
+        return num_found;
+      }
+      if (portal[n]) {
+        g->found[num_found].portal = portal[n] - 1;
+        g->found[num_found++].cost = dist[n];
+      } else {
+        g->fifo[tail++] = n;
+      }
+    }
+  }
+
+  return num_found;
+}
+
+static inline uint32_t king_distance(int32_t x1, int32_t y1,
+                                     int32_t x2, int32_t y2)
+{
+  uint32_t dx, dy;
+
+  dx = abs(x1 - x2);
+  dy = abs(y1 - y2);
+
+  return dx > dy ? dx : dy;
+}
+
+static void room_graph_link(std::vector<uint32_t> &links, uint32_t from,
+                            uint32_t to, uint32_t cost)
+{
+  links.push_back(from);
+  links.push_back(to);
+  links.push_back(cost);
+}
+
+/* A portal is any open cell in the ring around a room, corners and   *
+ * all.  Portals of a room are joined at the number of king's moves   *
+ * between them, which always works, the room being an open rectangle *
+ * right beside each of them.  Corridors are walked breadth-first from *
+ * each of their portals to the others, around the rooms rather than  *
+ * through them, at most UINT16_MAX - 1 steps; the rooms' edges do    *
+ * the rest.  Rooms never come within a cell of each other, so no     *
+ * ring runs into another room.                                       */
+void room_graph_build(dungeon *d)
+{
+  room_graph_t *g;
+  std::vector<uint32_t> links, ring, where;
+  uint32_t i, j, k, n, s, c, cost;
+  pair_t p;
+  room_t *r;
+
+  room_graph_delete(d);
+
+  if (dungeon_x(d) <= DUNGEON_X && dungeon_y(d) <= DUNGEON_Y) {
+    return;
+  }
+
+  g = d->room_graph = new room_graph_t;
+  g->portal.resize(dungeon_x(d), dungeon_y(d));
+  g->mark.resize(dungeon_x(d), dungeon_y(d));
+  g->dist.resize(dungeon_x(d), dungeon_y(d));
+  g->fifo = (cell_index_t *) malloc(dungeon_cells(d) * sizeof (*g->fifo));
+  g->flood = g->query = 0;
+  s = dungeon_stride(d);
+  g->neighbor[0] = -s - 1;
+  g->neighbor[1] = -s;
+  g->neighbor[2] = -s + 1;
+  g->neighbor[3] = -1;
+  g->neighbor[4] = 1;
+  g->neighbor[5] = s - 1;
+  g->neighbor[6] = s;
+  g->neighbor[7] = s + 1;
+
+  for (i = 0; i < d->num_rooms; i++) {
+    r = d->rooms + i;
+    ring.clear();
+    for (p[dim_y] = r->position[dim_y] - 1;
+         p[dim_y] <= r->position[dim_y] + r->size[dim_y];
+         p[dim_y]++) {
+      for (p[dim_x] = r->position[dim_x] - 1;
+           p[dim_x] <= r->position[dim_x] + r->size[dim_x];
+           p[dim_x]++) {
+        c = cell_index(d, p[dim_x], p[dim_y]);
+        if (mappair(p) < ter_floor || d->room_id.data()[c]) {
+          continue;
+        }
+        if (!g->portal.data()[c]) {
+          where.push_back(c);
+          g->portal.data()[c] = where.size();
+        }
+        ring.push_back(c);
+      }
+    }
+    for (j = 0; j < ring.size(); j++) {
+      for (k = 0; k < j; k++) {
+        cost = king_distance(ring[j] % s, ring[j] / s,
+                             ring[k] % s, ring[k] / s);
+        room_graph_link(links, g->portal.data()[ring[j]] - 1,
+                        g->portal.data()[ring[k]] - 1, cost);
+        room_graph_link(links, g->portal.data()[ring[k]] - 1,
+                        g->portal.data()[ring[j]] - 1, cost);
+      }
+    }
+  }
+
+  g->num_portals = where.size();
+  g->portals = (room_portal_t *) malloc((g->num_portals + 1) *
+                                        sizeof (*g->portals));
+  g->nodes = (room_graph_node_t *) malloc((g->num_portals + 1) *
+                                          sizeof (*g->nodes));
+  g->found = (room_graph_found_t *) malloc((g->num_portals + 1) *
+                                           sizeof (*g->found));
+  g->queue = (uint32_t *) malloc((g->num_portals + 1) * sizeof (*g->queue));
+  for (i = 0; i < g->num_portals; i++) {
+    g->portals[i].pos[dim_x] = where[i] % s;
+    g->portals[i].pos[dim_y] = where[i] / s;
+    n = room_graph_flood(d, g, where[i], UINT16_MAX - 1, d->room_id.data(),
+                         ROOM_GRAPH_NONE, &cost);
+    for (j = 0; j < n; j++) {
+      room_graph_link(links, i, g->found[j].portal, g->found[j].cost);
+    }
+  }
+
+  /* Sorted by where they're from, a count at a time; each portal's    *
+   * first ends up at the end of its edges, which is where the next    *
+   * one's start, and then everything moves up one.                    */
+  for (i = 0; i <= g->num_portals; i++) {
+    g->portals[i].first = 0;
+  }
+  for (i = 0; i < links.size(); i += 3) {
+    g->portals[links[i]].first++;
+  }
+  for (i = n = 0; i <= g->num_portals; i++) {
+    k = g->portals[i].first;
+    g->portals[i].first = n;
+    n += k;
+  }
+  g->edges = (room_edge_t *) malloc((n + 1) * sizeof (*g->edges));
+  for (i = 0; i < links.size(); i += 3) {
+    j = links[i];
+    g->edges[g->portals[j].first].to = links[i + 1];
+    g->edges[g->portals[j].first++].cost = links[i + 2];
+  }
+  for (i = g->num_portals; i; i--) {
+    g->portals[i].first = g->portals[i - 1].first;
+  }
+  g->portals[0].first = 0;
+
+  for (i = 0; i < g->num_portals; i++) {
+    g->nodes[i].index = i;
+    g->nodes[i].query = g->nodes[i].goal = 0;
+  }
+}
+
+void room_graph_delete(dungeon *d)
+{
+  room_graph_t *g;
+
+  if (!(g = d->room_graph)) {
+    return;
+  }
+
+  free(g->portals);
+  free(g->edges);
+  free(g->nodes);
+  free(g->queue);
+  free(g->found);
+  free(g->fifo);
+  delete g;
+  d->room_graph = NULL;
+}
+
+static inline void room_graph_place(room_graph_t *g, uint32_t slot,
+                                    uint32_t i)
+{
+  g->queue[slot] = i;
+  g->nodes[i].slot = slot;
+}
+
+static void room_graph_up(room_graph_t *g, uint32_t slot)
+{
+  uint32_t i, parent;
+
+  for (i = g->queue[slot]; slot; slot = parent) {
+    parent = (slot - 1) / 2;
+    if (g->nodes[i].key >= g->nodes[g->queue[parent]].key) {
+      break;
+    }
+    room_graph_place(g, slot, g->queue[parent]);
+  }
+  room_graph_place(g, slot, i);
+}
+
+static uint32_t room_graph_pop(room_graph_t *g)
+{
+  uint32_t top, i, slot, child;
+
+  top = g->queue[0];
+  g->nodes[top].slot = ROOM_GRAPH_NONE;
+  if (--g->size) {
+    i = g->queue[g->size];
+    for (slot = 0; (child = 2 * slot + 1) < g->size; slot = child) {
+      if (child + 1 < g->size &&
+          (g->nodes[g->queue[child + 1]].key <
+           g->nodes[g->queue[child]].key)) {
+        child++;
+      }
+      if (g->nodes[g->queue[child]].key >= g->nodes[i].key) {
+        break;
+      }
+      room_graph_place(g, slot, g->queue[child]);
+    }
+    room_graph_place(g, slot, i);
+  }
+
+  return top;
+}
+
+static void room_graph_relax(room_graph_t *g, uint32_t i, uint32_t cost,
+                             uint32_t from, pair_t to)
+{
+  room_graph_node_t *n;
+
+  n = g->nodes + i;
+  if (n->query != g->query) {
+    n->query = g->query;
+    n->cost = UINT32_MAX;
+    n->slot = ROOM_GRAPH_NONE;
+  }
+  if (cost >= n->cost) {
+    return;
+  }
+  n->cost = cost;
+  n->from = from;
+  n->key = cost + king_distance(g->portals[i].pos[dim_x],
+                                g->portals[i].pos[dim_y],
+                                to[dim_x], to[dim_y]);
+  if (n->slot == ROOM_GRAPH_NONE) {
+    g->queue[g->size] = i;
+    n->slot = g->size++;
+  }
+  room_graph_up(g, n->slot);
+}
+
+/* A* over the portals, from those around from to those around to, *
+ * with king's moves left as the heuristic; no edge is shorter than *
+ * that, so it's consistent.  If it gets there, via is set to the   *
+ * farthest portal along the way that's no more than a leg off, or  *
+ * to the first one, if none is, and it returns 1.  It returns 0 if *
+ * to is near enough that a plain search will do, or if the graph   *
+ * doesn't know the way.                                            */
+uint32_t room_graph_waypoint(dungeon *d, pair_t from, pair_t to, pair_t via)
+{
+  room_graph_t *g;
+  room_graph_node_t *n;
+  room_edge_t *e;
+  uint32_t source, target, num_found, direct, best, end, i;
+
+  if (!(g = d->room_graph)) {
+    return 0;
+  }
+
+  source = cell_index(d, from[dim_x], from[dim_y]);
+  target = cell_index(d, to[dim_x], to[dim_y]);
+  direct = ROOM_GRAPH_NONE;
+  g->query++;
+
+  /* The target is always open floor, so searching out of it only *
+   * ever takes in cells that can be walked out of, too.          */
+  num_found = room_graph_flood(d, g, target, ROOM_GRAPH_REACH, NULL,
+                               source, &direct);
+  if (direct != ROOM_GRAPH_NONE) {
+    return 0;
+  }
+  if (g->portal.data()[target]) {
+    g->found[num_found].portal = g->portal.data()[target] - 1;
+    g->found[num_found++].cost = 0;
+  }
+  if (!num_found) {
+    return 0;
+  }
+  for (i = 0; i < num_found; i++) {
+    n = g->nodes + g->found[i].portal;
+    n->goal = g->query;
+    n->goal_cost = g->found[i].cost;
+  }
+
+  g->size = 0;
+  num_found = room_graph_flood(d, g, source, ROOM_GRAPH_REACH, NULL,
+                               ROOM_GRAPH_NONE, &direct);
+  for (i = 0; i < num_found; i++) {
+    room_graph_relax(g, g->found[i].portal, g->found[i].cost,
+                     ROOM_GRAPH_NONE, to);
+  }
+  if (g->portal.data()[source]) {
+    room_graph_relax(g, g->portal.data()[source] - 1, 0,
+                     ROOM_GRAPH_NONE, to);
+  }
+
+  best = UINT32_MAX;
+  end = ROOM_GRAPH_NONE;
+  while (g->size) {
+    n = g->nodes + room_graph_pop(g);
+    if (n->key >= best) {
+      break;
+    }
+    if (n->goal == g->query && n->cost + n->goal_cost < best) {
+      best = n->cost + n->goal_cost;
+      end = n->index;
+    }
+    for (e = g->edges + g->portals[n->index].first;
+         e < g->edges + g->portals[n->index + 1].first;
+         e++) {
+      room_graph_relax(g, e->to, n->cost + e->cost, n->index, to);
+    }
+  }
+
+  if (end == ROOM_GRAPH_NONE || best <= ROOM_GRAPH_LEG) {
+    return 0;
+  }
+
+  /* Back from the end to the first portal within a leg, but never *
+   * back to one the route starts on.                              */
+  for (i = end;
+       (g->nodes[i].cost > ROOM_GRAPH_LEG              &&
+        g->nodes[i].from != ROOM_GRAPH_NONE            &&
+        g->nodes[g->nodes[i].from].cost);
+       i = g->nodes[i].from)
+    ;
+  if (!g->nodes[i].cost) {
+    return 0;
+  }
+  via[dim_x] = g->portals[i].pos[dim_x];
+  via[dim_y] = g->portals[i].pos[dim_y];
+
+  return 1;
+}
@@ -0,0 +1,31 @@
+#ifndef ROOMGRAPH_H
+# define ROOMGRAPH_H
+
+# include <stdio.h>
+# include <stdint.h>
+
+# include "dims.h"
+# include "path.h"
+
+class dungeon;
+
+/* Levels bigger than classic ones are too big to search cell by cell   *
+ * from one end to the other, so the generator also leaves behind a     *
+ * graph of them: every cell just outside a room that a corridor passes *
+ * through is a portal, and portals are joined to the other portals of  *
+ * the same room and to the ones at the far ends of their corridors,    *
+ * at the cost of walking there.  Long routes are worked out over that, *
+ * a few hundred portals instead of a million cells, and only the first *
+ * leg of one is ever searched cell by cell (see path_to()).            *
+ *                                                                      *
+ * Terrain only ever softens, so every route the graph knows of stays   *
+ * open; tunnelers may open shorter ones it doesn't know of, which      *
+ * costs some length, never a way through.  Classic levels get no       *
+ * graph at all, and route exactly as they always have.                 */
+# define ROOM_GRAPH_LEG PATH_MAX_ROUTE
+
+void room_graph_build(dungeon *d);
+void room_graph_delete(dungeon *d);
+uint32_t room_graph_waypoint(dungeon *d, pair_t from, pair_t to, pair_t via);
+
+#endif
@@ -3,14 +3,18 @@
 
 # include <assert.h>
 # include <stdlib.h>
+# include <stdint.h>
+
+# include "rng.h"
 
 /* Returns true if random float in [0,1] is less than *
  * numerator/denominator.  Uses only integer math.    */
-# define rand_under(numerator, denominator) \
-  (rand() < ((RAND_MAX / denominator) * numerator))
+# define rand_under(r, numerator, denominator) \
+  (rng_below((r), (denominator)) < (numerator))
 
-/* Returns random integer in [min, max]. */
-# define rand_range(min, max) ((rand() % (((max) + 1) - (min))) + (min))
+/* Returns random integer in [min, max], drawn from generator r. */
+# define rand_range(r, min, max) \
+  (rng_below((r), ((max) + 1) - (min)) + (min))
 
 #define malloc(size) ({          \
   void *_tmp;                    \